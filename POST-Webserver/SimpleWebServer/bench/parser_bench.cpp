@@ -0,0 +1,208 @@
+/*
+ * 请求解析的微基准：逐字节的原解析方式 与 http_scan的各个实现 对比
+ * 两种方式都按http_conn的流程切分请求行和头部，
+ * 每轮先把请求复制到读缓冲区（解析会写入'\0'），复制的开销两者相同
+ * 用法：./bench/parser_bench [轮数]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "http_scan.h"
+
+// 浏览器发出的典型请求，以及只有少量头部的压测请求
+static const char *requests[] = {
+    "GET /picture.html HTTP/1.1\r\n"
+    "Host: 192.168.141.128:12345\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, "
+    "like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/"
+    "avif,image/webp,image/apng,*/*;q=0.8\r\n"
+    "Referer: http://192.168.141.128:12345/judge.html\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "Range: bytes=0-1023\r\n"
+    "\r\n",
+    "GET /1 HTTP/1.1\r\n"
+    "Host: 127.0.0.1\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n",
+};
+
+struct parsed {
+    const char *method;
+    const char *url;
+    const char *version;
+    const char *host;
+    const char *range;
+    bool linger;
+    int content_length;
+};
+
+// 原来的实现：逐字节找行尾，strpbrk切分请求行，按头部名依次strncasecmp
+static int legacy_parse(char *buf, int len, parsed *r) {
+    int start = 0, idx = 0, line = 0;
+    while (idx < len) {
+        for (; idx < len; ++idx) {
+            if (buf[idx] == '\r' && idx + 1 < len && buf[idx + 1] == '\n')
+                break;
+        }
+        if (idx >= len)
+            return -1;
+        buf[idx++] = '\0';
+        buf[idx++] = '\0';
+        char *text = buf + start;
+        start = idx;
+        if (line++ == 0) {
+            char *url = strpbrk(text, " \t");
+            if (!url)
+                return -1;
+            *url++ = '\0';
+            r->method = text;
+            url += strspn(url, " \t");
+            char *version = strpbrk(url, " \t");
+            if (!version)
+                return -1;
+            *version++ = '\0';
+            version += strspn(version, " \t");
+            r->url = url;
+            r->version = version;
+        } else if (text[0] == '\0') {
+            return 0;
+        } else if (strncasecmp(text, "Connection:", 11) == 0) {
+            text += 11;
+            text += strspn(text, " \t");
+            r->linger = strcasecmp(text, "keep-alive") == 0;
+        } else if (strncasecmp(text, "Content-length:", 15) == 0) {
+            text += 15;
+            text += strspn(text, " \t");
+            r->content_length = atoi(text);
+        } else if (strncasecmp(text, "Host:", 5) == 0) {
+            text += 5;
+            text += strspn(text, " \t");
+            r->host = text;
+        } else if (strncasecmp(text, "Range:", 6) == 0) {
+            text += 6;
+            text += strspn(text, " \t");
+            r->range = text;
+        } else if (strncasecmp(text, "If-Range:", 9) == 0) {
+            text += 9;
+        }
+    }
+    return -1;
+}
+
+// 与http_conn相同的向量化流程
+static int scan_parse(char *buf, int len, parsed *r) {
+    char *end = buf + len;
+    char *p = buf;
+    int line = 0;
+    while (p < end) {
+        char *eol = (char *)scan_line_end(p, end);
+        if (eol + 1 >= end || eol[0] != '\r' || eol[1] != '\n')
+            return -1;
+        eol[0] = eol[1] = '\0';
+        char *text = p;
+        p = eol + 2;
+        if (line++ == 0) {
+            char *url = (char *)scan_space(text, p);
+            if (*url == '\0')
+                return -1;
+            *url++ = '\0';
+            r->method = text;
+            url += strspn(url, " \t");
+            char *version = (char *)scan_space(url, p);
+            if (*version == '\0')
+                return -1;
+            *version++ = '\0';
+            version += strspn(version, " \t");
+            r->url = url;
+            r->version = version;
+            continue;
+        }
+        if (text[0] == '\0')
+            return 0;
+        char *colon = (char *)scan_colon(text, p);
+        if (*colon != ':')
+            continue;
+        int name_len = colon - text;
+        char *value = colon + 1;
+        value += strspn(value, " \t");
+        if (name_len == 10 && strncasecmp(text, "Connection", 10) == 0)
+            r->linger = strcasecmp(value, "keep-alive") == 0;
+        else if (name_len == 14 && strncasecmp(text, "Content-length", 14) == 0)
+            r->content_length = atoi(value);
+        else if (name_len == 4 && strncasecmp(text, "Host", 4) == 0)
+            r->host = value;
+        else if (name_len == 5 && strncasecmp(text, "Range", 5) == 0)
+            r->range = value;
+    }
+    return -1;
+}
+
+typedef int (*parse_fn)(char *, int, parsed *);
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static bool same(const parsed &a, const parsed &b) {
+    return strcmp(a.method, b.method) == 0 && strcmp(a.url, b.url) == 0 &&
+           strcmp(a.version, b.version) == 0 &&
+           strcmp(a.host, b.host) == 0 && a.linger == b.linger &&
+           (a.range == b.range || strcmp(a.range, b.range) == 0);
+}
+
+static double run(parse_fn fn, const char *req, int iters) {
+    char buf[2048];
+    int len = strlen(req);
+    volatile int sink = 0;
+    double begin = now_ns();
+    for (int i = 0; i < iters; ++i) {
+        memcpy(buf, req, len);
+        parsed r = parsed();
+        sink += fn(buf, len, &r) + (r.host ? 1 : 0);
+    }
+    return (now_ns() - begin) / iters;
+}
+
+int main(int argc, char *argv[]) {
+    int iters = argc > 1 ? atoi(argv[1]) : 1000000;
+    static const SCAN_LEVEL levels[] = {SCAN_SCALAR, SCAN_SSE42, SCAN_AVX2};
+    SCAN_LEVEL best = scan_best_level();
+
+    for (size_t n = 0; n < sizeof(requests) / sizeof(requests[0]); ++n) {
+        const char *req = requests[n];
+        int len = strlen(req);
+
+        // 先确认两种解析结果一致
+        char a[2048], b[2048];
+        parsed ra = parsed(), rb = parsed();
+        memcpy(a, req, len);
+        memcpy(b, req, len);
+        if (legacy_parse(a, len, &ra) != 0 || scan_parse(b, len, &rb) != 0 ||
+            !same(ra, rb)) {
+            printf("request %zu: result mismatch\n", n);
+            return 1;
+        }
+
+        printf("request %zu (%d bytes), %d iterations\n", n, len, iters);
+        double base = run(legacy_parse, req, iters);
+        printf("  %-8s %8.1f ns/req %8.2f GB/s\n", "legacy", base, len / base);
+        for (int l = 0; l <= best; ++l) {
+            scan_select(levels[l]);
+            double t = run(scan_parse, req, iters);
+            printf("  %-8s %8.1f ns/req %8.2f GB/s  x%.2f\n", scan_impl_name(),
+                   t, len / t, base / t);
+        }
+        scan_select(best);
+    }
+    return 0;
+}
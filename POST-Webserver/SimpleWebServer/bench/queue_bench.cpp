@@ -0,0 +1,168 @@
+/*
+ * 线程池请求队列的竞争基准：n个生产者 + n个消费者，n从1到64
+ * 对比原来的 std::list + 互斥锁 + 信号量 与 无锁环形队列 + futex停靠
+ * 消费者只做计数，测的是队列本身在竞争下的吞吐
+ * 用法：./bench/queue_bench [每轮的请求数]
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <list>
+
+#include "locker.h"
+#include "mpmc_queue.h"
+
+static const int MAX_REQUESTS = 10000;
+
+// 原来的实现，与threadpool中的append()、run()相同
+class legacy_queue {
+  public:
+    bool append(int *request) {
+        m_queuelocker.lock();
+        if ((int)m_workqueue.size() > MAX_REQUESTS) {
+            m_queuelocker.unlock();
+            return false;
+        }
+        m_workqueue.push_back(request);
+        m_queuelocker.unlock();
+        m_queuestat.post();
+        return true;
+    }
+    int *take() {
+        while (true) {
+            m_queuestat.wait();
+            m_queuelocker.lock();
+            if (m_workqueue.empty()) {
+                m_queuelocker.unlock();
+                continue;
+            }
+            int *request = m_workqueue.front();
+            m_workqueue.pop_front();
+            m_queuelocker.unlock();
+            return request;
+        }
+    }
+
+  private:
+    std::list<int *> m_workqueue;
+    locker m_queuelocker;
+    sem m_queuestat;
+};
+
+// 新的实现，与threadpool中的append()、run()相同
+class ring_queue {
+  public:
+    ring_queue() : m_workqueue(MAX_REQUESTS) {}
+    bool append(int *request) {
+        if (!m_workqueue.push(request))
+            return false;
+        m_parker.notify_one();
+        return true;
+    }
+    int *take() {
+        int *request;
+        while (true) {
+            if (m_workqueue.pop(request))
+                return request;
+            uint32_t key = m_parker.prepare_wait();
+            if (m_workqueue.pop(request)) {
+                m_parker.cancel_wait();
+                return request;
+            }
+            m_parker.wait(key);
+        }
+    }
+
+  private:
+    mpmc_queue<int *> m_workqueue;
+    parker m_parker;
+};
+
+static int dummy;
+static int stop_mark;
+
+template <typename Q> struct context {
+    Q *queue;
+    int per_producer;
+    long long consumed;
+};
+
+// 队列满时与线程池的调用方一样只能放弃，这里让出CPU后重试
+template <typename Q> static void push(Q *q, int *request) {
+    while (!q->append(request))
+        sched_yield();
+}
+
+template <typename Q> static void *producer(void *arg) {
+    context<Q> *ctx = (context<Q> *)arg;
+    for (int i = 0; i < ctx->per_producer; ++i)
+        push(ctx->queue, &dummy);
+    return NULL;
+}
+
+template <typename Q> static void *consumer(void *arg) {
+    context<Q> *ctx = (context<Q> *)arg;
+    while (ctx->queue->take() != &stop_mark)
+        ++ctx->consumed;
+    return NULL;
+}
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 返回每秒处理的请求数（百万）
+template <typename Q> static double run(int threads, int total) {
+    Q queue;
+    context<Q> prod = {&queue, total / threads, 0};
+    context<Q> *cons = new context<Q>[threads];
+    pthread_t *pt = new pthread_t[threads];
+    pthread_t *ct = new pthread_t[threads];
+
+    double begin = now_sec();
+    for (int i = 0; i < threads; ++i) {
+        cons[i].queue = &queue;
+        cons[i].consumed = 0;
+        pthread_create(&ct[i], NULL, consumer<Q>, &cons[i]);
+    }
+    for (int i = 0; i < threads; ++i)
+        pthread_create(&pt[i], NULL, producer<Q>, &prod);
+    for (int i = 0; i < threads; ++i)
+        pthread_join(pt[i], NULL);
+    // 生产者都结束后给每个消费者一个结束标记
+    for (int i = 0; i < threads; ++i)
+        push(&queue, &stop_mark);
+    long long consumed = 0;
+    for (int i = 0; i < threads; ++i) {
+        pthread_join(ct[i], NULL);
+        consumed += cons[i].consumed;
+    }
+    double elapsed = now_sec() - begin;
+
+    delete[] cons;
+    delete[] pt;
+    delete[] ct;
+    if (consumed != (long long)prod.per_producer * threads) {
+        printf("lost requests: %lld of %lld\n", consumed,
+               (long long)prod.per_producer * threads);
+        exit(1);
+    }
+    return consumed / elapsed / 1e6;
+}
+
+int main(int argc, char *argv[]) {
+    int total = argc > 1 ? atoi(argv[1]) : 2000000;
+    printf("%d requests per run, n producers + n consumers\n", total);
+    printf("  %8s %14s %14s %8s\n", "threads", "legacy Mops/s", "ring Mops/s",
+           "speedup");
+    for (int n = 1; n <= 64; n *= 2) {
+        double legacy = run<legacy_queue>(n, total);
+        double ring = run<ring_queue>(n, total);
+        printf("  %8d %14.2f %14.2f %7.2fx\n", n, legacy, ring, ring / legacy);
+    }
+    return 0;
+}
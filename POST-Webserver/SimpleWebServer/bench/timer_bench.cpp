@@ -0,0 +1,145 @@
+/*
+ * 定时器容器的微基准：大量连接不断有数据到达，每次读写都把定时器往后延
+ * 对比原来基于priority_queue、删除时重建整个堆的实现与带下标的4叉堆
+ * 时间用递增的计数模拟，不调用clock_gettime，只测容器本身的开销
+ * 用法：./bench/timer_bench [连接数] [轮数]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <queue>
+#include <vector>
+
+#include "heap_timer.h"
+
+// 原来的实现：调整 = 删除 + 插入，删除时弹出所有元素再压回
+class legacy_timer {
+  public:
+    struct cmp {
+        bool operator()(const util_timer *f1, const util_timer *f2) {
+            return f1->expire > f2->expire;
+        }
+    };
+    void add_timer(util_timer *timer) { m_pq.push(timer); }
+    void adjust_timer(util_timer *timer) {
+        del_timer(timer);
+        add_timer(timer);
+    }
+    void del_timer(util_timer *timer) {
+        std::vector<util_timer *> vec;
+        vec.reserve(m_pq.size() - 1);
+        while (!m_pq.empty()) {
+            if (m_pq.top() != timer)
+                vec.push_back(m_pq.top());
+            m_pq.pop();
+        }
+        for (auto &t : vec)
+            m_pq.push(t);
+    }
+
+  private:
+    std::priority_queue<util_timer *, std::vector<util_timer *>, cmp> m_pq;
+};
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// 固定种子的线性同余，两种实现访问相同的连接序列
+static unsigned next_rand(unsigned &seed) {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+static const long long TIMEOUT = 15000;
+
+// 随机挑一个连接，把它的超时时间设为“现在”加超时，返回每次调整的纳秒数
+template <typename T>
+static double rearm(T &timers, std::vector<util_timer> &conns, int iters) {
+    unsigned seed = 1;
+    long long clock = TIMEOUT;
+    double begin = now_ns();
+    for (int i = 0; i < iters; ++i) {
+        util_timer *t = &conns[next_rand(seed) % conns.size()];
+        t->expire = ++clock + TIMEOUT;
+        timers.adjust_timer(t);
+    }
+    return (now_ns() - begin) / iters;
+}
+
+// 随机挑一个连接关闭再接入新连接，返回每对删除+插入的纳秒数
+template <typename T>
+static double churn(T &timers, std::vector<util_timer> &conns, int iters) {
+    unsigned seed = 2;
+    long long clock = TIMEOUT * 2;
+    double begin = now_ns();
+    for (int i = 0; i < iters; ++i) {
+        util_timer *t = &conns[next_rand(seed) % conns.size()];
+        timers.del_timer(t);
+        t->expire = ++clock + TIMEOUT;
+        timers.add_timer(t);
+    }
+    return (now_ns() - begin) / iters;
+}
+
+template <typename T>
+static void fill(T &timers, std::vector<util_timer> &conns) {
+    for (size_t i = 0; i < conns.size(); ++i) {
+        conns[i].expire = TIMEOUT + (long long)i * TIMEOUT / conns.size();
+        timers.add_timer(&conns[i]);
+    }
+}
+
+// 按定时器记录的下标还原堆数组，检查下标唯一且满足4叉小顶堆的堆序
+static bool check(HeapTimer &timers, std::vector<util_timer> &conns) {
+    int n = conns.size();
+    if (timers.size() != n)
+        return false;
+    std::vector<util_timer *> heap(n, (util_timer *)NULL);
+    for (int i = 0; i < n; ++i) {
+        int idx = conns[i].heap_index;
+        if (idx < 0 || idx >= n || heap[idx])
+            return false;
+        heap[idx] = &conns[i];
+    }
+    for (int i = 1; i < n; ++i) {
+        if (heap[(i - 1) / 4]->expire > heap[i]->expire)
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    int n = argc > 1 ? atoi(argv[1]) : 100000;
+    int iters = argc > 2 ? atoi(argv[2]) : 10000000;
+    // 原实现每次调整都是O(n log n)，只跑少量轮次
+    int legacy_iters = iters / 100000 > 0 ? iters / 100000 : 1;
+
+    printf("%d connections\n", n);
+    {
+        std::vector<util_timer> conns(n);
+        legacy_timer timers;
+        fill(timers, conns);
+        double t = rearm(timers, conns, legacy_iters);
+        printf("  %-10s rearm %12.1f ns/op  (%d ops)\n", "legacy", t,
+               legacy_iters);
+    }
+    {
+        std::vector<util_timer> conns(n);
+        HeapTimer timers;
+        fill(timers, conns);
+        double t = rearm(timers, conns, iters);
+        printf("  %-10s rearm %12.1f ns/op  (%d ops)\n", "4-ary heap", t,
+               iters);
+        t = churn(timers, conns, iters);
+        printf("  %-10s churn %12.1f ns/op  (%d ops)\n", "4-ary heap", t,
+               iters);
+        if (!check(timers, conns)) {
+            printf("heap check failed\n");
+            return 1;
+        }
+    }
+    return 0;
+}
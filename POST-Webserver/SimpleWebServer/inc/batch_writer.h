@@ -0,0 +1,73 @@
+#ifndef BATCH_WRITER_H
+#define BATCH_WRITER_H
+
+#include <deque>
+#include <pthread.h>
+#include <string>
+#include "breaker.h"
+#include "locker.h"
+#include "sql_connection_pool.h"
+
+/*
+ * 注册用户的批量写入
+ * 1. 处理线程调用insert()把一行放入队列后等待，写入线程一次取出队列中的多行，
+ *    用一条多行INSERT写入，语句执行完成（自动提交）后唤醒这一批的所有处理线程，
+ *    处理线程这时才回复客户端
+ * 2. 不额外等待凑批：一批在写入时新到的行在队列中积累，下一批一起写入，
+ *    注册越集中每批的行数越多，每批最多max_rows行；
+ *    每个等待中的处理线程只提交一行，每批的行数也不会超过调用insert()的线程数，
+ *    即数据库通道的线程数
+ * 3. 多行INSERT因SQL错误（如用户名已存在）失败时逐行重写，一行出错不影响同批的其他行
+ * 4. 每种行数的INSERT都是连接上缓存的预处理语句，参数按类型绑定
+ * max_rows不大于1时不启动写入线程，insert()在调用线程中直接写入一行
+ */
+class batch_writer {
+  public:
+    // 每批最多的行数，每种行数占用一条连接上的预处理语句
+    static const int MAX_ROWS = connection_pool::MAX_STATEMENTS;
+
+    static batch_writer *get_instance() {
+        static batch_writer instance;
+        return &instance;
+    }
+
+    // 每批取连接、写入的结果计入熔断器；max_rows大于1时启动写入线程
+    bool init(connection_pool *pool, breaker *db_breaker, int max_rows);
+    // 写入一行，返回时已经写入数据库或已经失败，成功返回0
+    int insert(const char *name, const char *password);
+    // 写完队列中已有的行后停止写入线程
+    void stop();
+
+  private:
+    batch_writer();
+    ~batch_writer();
+
+    // 等待写入的一行，在调用insert()的线程栈上
+    struct row {
+        const char *name;
+        const char *password;
+        int res;   // 写入结果，0表示成功
+        bool done; // 所在批次是否已经完成
+    };
+    static void *worker(void *arg);
+    void run();
+    // 取一条连接写入一批，并把结果记录到熔断器
+    void write(row **rows, int n);
+    // 用n行的预处理语句执行一次插入
+    int execute(MYSQL *mysql, row **rows, int n);
+
+  private:
+    connection_pool *m_pool;
+    breaker *m_breaker;
+    int m_max_rows;
+    std::string m_sql[MAX_ROWS]; // n行INSERT的语句文本在m_sql[n-1]
+    std::deque<row *> m_queue;
+    locker m_lock;
+    cond m_ready; // 通知写入线程有新的行
+    cond m_done;  // 通知处理线程有批次完成
+    pthread_t m_thread;
+    bool m_started;
+    bool m_stop;
+};
+
+#endif // BATCH_WRITER_H
@@ -0,0 +1,63 @@
+#ifndef BLOCK_POOL_H
+#define BLOCK_POOL_H
+
+#include <atomic>
+#include <stddef.h>
+
+#include "locker.h"
+
+/*
+ * 进程内共享的内存块池，块大小为4KB到64KB的2的幂
+ * 连接收到数据时才取块，请求处理完、响应发送完就归还，
+ * 空闲连接不占用缓冲区；归还的块按大小缓存在空闲链表中复用
+ * 每个NUMA节点有各自的空闲链表，线程只从所在节点的链表中取块、把块还到所在节点的链表，
+ * 绑定了CPU的线程拿到的块大多是本节点的线程用过的、位于本地内存的块
+ */
+class block_pool {
+  public:
+    static const size_t MIN_BLOCK_SIZE = 4096; // 最小的块
+    static const int CLASS_NUMBER = 5;     // 4K 8K 16K 32K 64K
+    static const size_t MAX_BLOCK_SIZE =
+        MIN_BLOCK_SIZE << (CLASS_NUMBER - 1);
+    static const int MAX_NODES = 8; // 节点更多时按编号取模共用链表
+
+    // C++11以后,使用局部静态变量实现单例模式不用加锁
+    static block_pool *get_instance() {
+        static block_pool instance;
+        return &instance;
+    }
+
+    // 每个节点每种大小最多缓存的空闲字节数，超出的块直接释放
+    void init(size_t max_free_bytes);
+
+    // size向上取整为块大小，超过MAX_BLOCK_SIZE时返回NULL
+    char *acquire(size_t size);
+    // size必须与acquire时相同
+    void release(char *block, size_t size);
+
+    // 正在被连接使用的字节数
+    size_t used_bytes() { return m_used_bytes; }
+
+  private:
+    block_pool();
+    ~block_pool();
+
+    static int size_class(size_t size);
+
+  private:
+    struct free_block {
+        free_block *next;
+    };
+    struct free_list {
+        free_block *head;
+        size_t count;
+        locker lock;
+    };
+    free_list &local_list(int idx);
+
+    free_list m_free[MAX_NODES][CLASS_NUMBER];
+    size_t m_max_free_bytes;
+    std::atomic<size_t> m_used_bytes;
+};
+
+#endif // BLOCK_POOL_H
@@ -0,0 +1,73 @@
+#ifndef BREAKER_H
+#define BREAKER_H
+
+#include <atomic>
+#include <time.h>
+
+/*
+ * 数据库熔断器
+ * 1. 连续threshold次失败（取不到连接、连接错误、查询过慢）后断开，
+ *    断开期间allow()返回false，调用方直接回复错误页面，不再排队等待数据库
+ * 2. 断开open_ms后放行一个试探请求，它成功则恢复，失败则再断开open_ms；
+ *    试探请求没有用到数据库时，下一个open_ms后再放行一个
+ * 多个线程并发调用，只用原子变量维护状态
+ */
+class breaker {
+  public:
+    breaker()
+        : m_threshold(0), m_slow_ms(0), m_open_ms(0), m_failures(0),
+          m_open(false), m_retry_at(0) {}
+
+    // threshold为0时不熔断；耗时超过slow_ms的操作算作失败
+    void init(int threshold, int slow_ms, int open_ms) {
+        m_threshold = threshold;
+        m_slow_ms = slow_ms;
+        m_open_ms = open_ms;
+    }
+
+    // 在把请求交给数据库之前调用
+    bool allow() {
+        if (!m_open.load(std::memory_order_acquire))
+            return true;
+        long long now = now_ms();
+        long long retry_at = m_retry_at.load(std::memory_order_relaxed);
+        if (now < retry_at)
+            return false;
+        // 冷却结束，只有一个线程能放行试探请求
+        return m_retry_at.compare_exchange_strong(retry_at, now + m_open_ms);
+    }
+
+    // 记录一次数据库操作的结果和耗时，返回true表示这次失败使熔断器断开
+    bool record(bool ok, long long elapsed_ms) {
+        if (ok && elapsed_ms <= m_slow_ms) {
+            m_failures.store(0, std::memory_order_relaxed);
+            m_open.store(false, std::memory_order_release);
+            return false;
+        }
+        int failures = m_failures.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (m_threshold <= 0 ||
+            (failures < m_threshold && !m_open.load(std::memory_order_relaxed)))
+            return false;
+        m_retry_at.store(now_ms() + m_open_ms, std::memory_order_relaxed);
+        return !m_open.exchange(true, std::memory_order_acq_rel);
+    }
+
+    bool is_open() const { return m_open.load(std::memory_order_relaxed); }
+
+  private:
+    static long long now_ms() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+    }
+
+  private:
+    int m_threshold;
+    int m_slow_ms;
+    int m_open_ms;
+    std::atomic<int> m_failures;       // 连续失败次数
+    std::atomic<bool> m_open;          // 是否处于断开状态
+    std::atomic<long long> m_retry_at; // 断开时，下一次放行试探请求的时间
+};
+
+#endif // BREAKER_H
@@ -0,0 +1,44 @@
+#ifndef CHAIN_BUFFER_H
+#define CHAIN_BUFFER_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include "block_pool.h"
+
+/*
+ * 由block_pool中的块串成的写缓冲区，写满一个块后再取下一个，
+ * 内容不要求连续，通过take_iov按块生成iovec交给writev/sendmsg
+ * 位置用从头开始的字节偏移表示
+ */
+class chain_buffer {
+  public:
+    static const int MAX_BLOCKS = 16; // 最多64KB
+
+    chain_buffer() : m_count(0), m_size(0), m_mark(0), m_last("") {}
+    ~chain_buffer() { clear(); }
+
+    // 追加格式化的内容，尾块放不下时整段写到新块中，单次追加不能超过一个块
+    bool append(const char *format, va_list args);
+    // 把上次take_iov之后追加的内容按块写入iv，最多max个，返回个数，放不下时返回-1
+    int take_iov(struct iovec *iv, int max);
+    // 回退到pos处，丢弃之后追加的内容
+    void truncate(size_t pos);
+    // 归还所有块
+    void clear();
+
+    size_t size() const { return m_size; }
+    // 最近一次追加的内容，以'\0'结尾，用于日志
+    const char *last() const { return m_last; }
+
+  private:
+    char *m_blocks[MAX_BLOCKS];
+    size_t m_lens[MAX_BLOCKS];
+    int m_count;
+    size_t m_size;
+    size_t m_mark; // take_iov已经取走的位置
+    const char *m_last;
+};
+
+#endif // CHAIN_BUFFER_H
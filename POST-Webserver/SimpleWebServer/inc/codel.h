@@ -0,0 +1,52 @@
+#ifndef CODEL_H
+#define CODEL_H
+
+#include <atomic>
+
+/*
+ * 按排队时间丢弃请求的过载判定，思路来自CoDel（Controlled Delay）
+ * 1. 统计每个interval内取出的请求的最小排队时间，
+ *    最小值都超过target说明队列一直没有排空，处于持续过载而不是短暂的突发
+ * 2. 过载期间排队超过target的请求直接丢弃，队列很快排空，
+ *    排队时间回落后的下一个interval自动退出过载状态
+ * 多个工作线程并发调用，状态只用原子变量维护，统计允许有少量误差
+ */
+class codel {
+  public:
+    codel(long long target_us, long long interval_us)
+        : m_target(target_us), m_interval(interval_us), m_interval_start(0),
+          m_min_sojourn(-1), m_overloaded(false) {}
+
+    // 取出请求时调用，返回true表示应当丢弃这个请求
+    bool should_drop(long long sojourn_us, long long now_us) {
+        long long min = m_min_sojourn.load(std::memory_order_relaxed);
+        while ((min < 0 || sojourn_us < min) &&
+               !m_min_sojourn.compare_exchange_weak(min, sojourn_us))
+            continue;
+
+        long long start = m_interval_start.load(std::memory_order_relaxed);
+        if (start == 0) {
+            m_interval_start.compare_exchange_strong(start, now_us);
+        } else if (now_us - start >= m_interval &&
+                   m_interval_start.compare_exchange_strong(start, now_us)) {
+            // 由一个线程结束本interval，按最小排队时间决定下一个interval的状态
+            long long last_min = m_min_sojourn.exchange(-1);
+            m_overloaded.store(last_min > m_target, std::memory_order_relaxed);
+        }
+        return m_overloaded.load(std::memory_order_relaxed) &&
+               sojourn_us > m_target;
+    }
+
+    bool overloaded() const {
+        return m_overloaded.load(std::memory_order_relaxed);
+    }
+
+  private:
+    long long m_target;   // 可接受的排队时间，单位微秒
+    long long m_interval; // 统计窗口，单位微秒
+    std::atomic<long long> m_interval_start;
+    std::atomic<long long> m_min_sojourn; // 本interval内的最小排队时间，-1表示还没有请求
+    std::atomic<bool> m_overloaded;
+};
+
+#endif // CODEL_H
@@ -0,0 +1,66 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <atomic>
+#include <list>
+#include <string>
+#include <sys/stat.h>
+#include <time.h>
+#include <unordered_map>
+
+#include "locker.h"
+
+// 缓存的一个文件，引用计数为0时释放内存
+struct file_entry {
+    std::string path;
+    char *data;            // 文件内容，响应时iovec直接指向这里
+    struct stat st;        // 加载时的文件信息，用于判断文件是否被修改
+    time_t checked;        // 上次检查文件是否被修改的时间
+    std::atomic<int> ref;  // 缓存本身持有一个引用，每个正在发送的响应持有一个
+    bool cached;           // 是否还在缓存中
+    std::list<file_entry *>::iterator lru; // 在LRU链表中的位置
+};
+
+/*
+ * 进程内共享的静态文件缓存，以文件路径为键
+ * 1. 文件内容读入堆内存，多个连接共享同一份，不再每个请求stat/open/mmap/munmap
+ * 2. 按总字节数限制大小，超出后按LRU淘汰，淘汰时正在发送的响应仍持有引用
+ * 3. 每隔check_interval秒对命中的文件stat一次，修改时间或大小变化时重新加载
+ */
+class file_cache {
+  public:
+    // C++11以后,使用局部静态变量实现单例模式不用加锁
+    static file_cache *get_instance() {
+        static file_cache instance;
+        return &instance;
+    }
+
+    // max_bytes为0时关闭缓存；超过max_file_size的文件不缓存
+    void init(size_t max_bytes, size_t max_file_size = 1 << 20,
+              int check_interval = 1);
+
+    // 获取文件，成功时返回的entry持有一个引用，需要release；
+    // 文件不存在、不可读、是目录或不适合缓存时返回NULL，由调用者自行处理
+    // 返回NULL前已经stat过时*stated为true，结果在st中，stat失败时st_mode为0
+    file_entry *acquire(const char *path, struct stat *st, bool *stated);
+    void release(file_entry *entry);
+
+  private:
+    file_cache();
+    ~file_cache();
+
+    file_entry *load(const char *path, const struct stat &st);
+    void drop(file_entry *entry);
+    void evict();
+
+  private:
+    size_t m_max_bytes;
+    size_t m_max_file_size;
+    int m_check_interval;
+    size_t m_cur_bytes;
+    std::unordered_map<std::string, file_entry *> m_entries;
+    std::list<file_entry *> m_lru; // 表头为最近使用
+    locker m_lock;
+};
+
+#endif // FILE_CACHE_H
@@ -2,95 +2,149 @@
 #define HEAP_TIMER_H
 
 #include <time.h>
-#include <queue>
 #include <vector>
 #include "log.h"
 
-class util_timer;
+class http_conn;
 
-// 用户数据结构
-struct client_data {
-    sockaddr_in address; // 客户端socket地址
-    int sockfd;          // socket文件描述符
-    util_timer *timer;   // 定时器
-};
+// 单调时钟的毫秒数，不受系统时间调整影响；clock_gettime走vDSO，不进入内核
+inline long long timer_now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
 
 // 通用定时器类
 class util_timer {
   public:
-    util_timer() {}
+    util_timer() : heap_index(-1) {}
 
-  public:
-    time_t expire; /*任务的超时时间，这里使用绝对时问*/
-    void (*cb_func)(client_data *); // 任务回调函数
-    client_data *user_data;
-};
+    // 是否在定时器容器中
+    bool armed() const { return heap_index >= 0; }
 
-struct timer_cmp {
-    bool operator()(const util_timer *f1, const util_timer *f2) {
-        // 小顶堆
-        return f1->expire > f2->expire;
-    }
+  public:
+    long long expire; // 任务的超时时间，timer_now_ms()的绝对时间
+    void (*cb_func)(http_conn *); // 任务回调函数
+    http_conn *user_data;         // 对应的连接
+    int heap_index;               // 在堆数组中的下标，不在堆中时为-1
 };
 
+/*
+ * 带下标的4叉小顶堆，定时器记录自己在堆中的位置
+ * 1. 调整和删除直接从该位置上浮或下沉，O(log n)，不需要遍历整个堆
+ * 2. 4叉堆比二叉堆矮一半，下沉时4个子节点在相邻的内存中
+ * 连接每次读写都会延长超时时间，调整是最频繁的操作
+ * 定时器嵌在连接对象中，容器只保存指针，不负责创建和释放
+ */
 class HeapTimer {
   public:
     HeapTimer(){};
-    ~HeapTimer() {
-        // 释放所有定时器的堆内存
-        while (!m_pq.empty()) {
-            util_timer *curr = m_pq.top();
-            m_pq.pop();
-            delete curr;
-        }
-    };
 
     void add_timer(util_timer *timer) {
-        // 直接插入即可
-        m_pq.push(timer);
+        timer->heap_index = m_heap.size();
+        m_heap.push_back(timer);
+        sift_up(timer->heap_index);
     }
 
-    // 考虑定时器时间延长
+    // 修改expire后调用，延长或缩短都可以
     void adjust_timer(util_timer *timer) {
-        del_timer(timer);
-        add_timer(timer);
+        int i = timer->heap_index;
+        if (i < 0)
+            return;
+        if (i > 0 && m_heap[parent(i)]->expire > timer->expire)
+            sift_up(i);
+        else
+            sift_down(i);
     };
 
-    // 删除定时器
+    // 删除定时器，不释放内存
     void del_timer(util_timer *timer) {
-        std::vector<util_timer *> vec;
-        vec.reserve(m_pq.size() - 1);
-        while (!m_pq.empty()) {
-            // printf("%ld\n", m_pq.top()->expire);
-            if (m_pq.top() != timer) {
-                vec.push_back(m_pq.top());
-            }
-            m_pq.pop();
-        }
-        for (auto &t : vec) {
-            m_pq.push(t);
-        }
+        int i = timer->heap_index;
+        if (i < 0)
+            return;
+        timer->heap_index = -1;
+        util_timer *last = m_heap.back();
+        m_heap.pop_back();
+        if (last == timer)
+            return;
+        // 用最后一个元素填补空位，再恢复堆序
+        place(i, last);
+        adjust_timer(last);
+    }
+
+    int size() const { return (int)m_heap.size(); }
+
+    // 距最早的定时器到期还有多少毫秒，作为epoll_wait的超时；没有定时器时为-1
+    int next_timeout() {
+        if (m_heap.empty())
+            return -1;
+        long long diff = m_heap[0]->expire - timer_now_ms();
+        return diff > 0 ? (int)diff : 0;
     }
 
-    // 根据alarm，每隔一段时间tick一下以处理事件
+    // 每次等待返回后调用，处理所有已经到期的定时器
     void tick() {
+        if (m_heap.empty())
+            return;
+        long long cur = timer_now_ms();
+        if (m_heap[0]->expire > cur)
+            return;
         // 输出日志
         LOG_INFO("%s", "timer tick");
         Log::get_instance()->flush();
 
-        time_t cur = time(NULL);
-        while (!m_pq.empty() && m_pq.top()->expire <= cur) {
-            util_timer *tmp = m_pq.top();
-            m_pq.pop();
-            // 执行回调函数,并删除定时器
+        while (!m_heap.empty() && m_heap[0]->expire <= cur) {
+            util_timer *tmp = m_heap[0];
+            del_timer(tmp);
+            // 执行回调函数，回调中可能释放定时器所在的对象，之后不能再访问tmp
             tmp->cb_func(tmp->user_data);
-            delete tmp;
         }
     }
 
   private:
-    std::priority_queue<util_timer *, std::vector<util_timer *>, timer_cmp>
-        m_pq;
+    static int parent(int i) { return (i - 1) >> 2; }
+
+    void place(int i, util_timer *timer) {
+        m_heap[i] = timer;
+        timer->heap_index = i;
+    }
+
+    void sift_up(int i) {
+        util_timer *timer = m_heap[i];
+        while (i > 0) {
+            int p = parent(i);
+            if (m_heap[p]->expire <= timer->expire)
+                break;
+            place(i, m_heap[p]);
+            i = p;
+        }
+        place(i, timer);
+    }
+
+    void sift_down(int i) {
+        util_timer *timer = m_heap[i];
+        int n = m_heap.size();
+        while (true) {
+            int first = (i << 2) + 1;
+            if (first >= n)
+                break;
+            // 4个子节点中最早到期的一个
+            int last = first + 4 < n ? first + 4 : n;
+            int min = first;
+            for (int c = first + 1; c < last; ++c) {
+                if (m_heap[c]->expire < m_heap[min]->expire)
+                    min = c;
+            }
+            if (m_heap[min]->expire >= timer->expire)
+                break;
+            place(i, m_heap[min]);
+            i = min;
+        }
+        place(i, timer);
+    }
+
+  private:
+    std::vector<util_timer *> m_heap;
 };
 
 #endif // HEAP_TIMER_H
\ No newline at end of file
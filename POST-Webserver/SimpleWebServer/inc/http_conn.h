@@ -19,15 +19,37 @@
 #include <errno.h>
 #include <sys/wait.h>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <atomic>
+#include "batch_writer.h"
+#include "block_pool.h"
+#include "breaker.h"
+#include "chain_buffer.h"
+#include "file_cache.h"
+#include "heap_timer.h"
 #include "locker.h"
 #include "sql_connection_pool.h"
 
+class reactor;
+
 // 线程池的模板参数类，用以封装对http连接的处理
+// 连接对象由所属反应堆的slab分配，连接、定时器和缓冲区状态都在这一个对象里
 class http_conn {
   public:
     static const int FILENAME_LEN = 200;
-    static const int READ_BUFFER_SIZE = 2048;
-    static const int WRITE_BUFFER_SIZE = 1024;
+    // 读缓冲区初始为一个最小块，放不下时翻倍，最大为block_pool的最大块
+    static const int READ_BUFFER_SIZE = block_pool::MIN_BLOCK_SIZE;
+    static const int MAX_READ_BUFFER_SIZE = block_pool::MAX_BLOCK_SIZE;
+    // 一个请求最多支持的范围个数
+    static const int MAX_RANGES = 8;
+    // 流水线中一次最多合并发送的响应数
+    static const int MAX_PIPELINE = 8;
+    // 响应头 + 每个范围的部分头和内容 + 结束分隔符，再加上排在前面的普通响应
+    // 写缓冲区跨块时一段内容会拆成两个iovec，每个响应多预留两个
+    static const int RESPONSE_IOV = 2 * MAX_RANGES + 4;
+    static const int IOV_SIZE = RESPONSE_IOV + 2 * MAX_PIPELINE;
+    // 503响应中建议客户端重试的间隔，单位秒
+    static const int RETRY_AFTER = 1;
     // 这里实现了GET 和 POST
     enum METHOD {
         GET = 0,
@@ -53,76 +75,169 @@ class http_conn {
         FORBIDDEN_REQUEST, // 请求资源禁止访问，没有读取权限,跳转process_write完成响应报文
         FILE_REQUEST, // 请求资源可以正常访问,跳转process_write完成响应报文
         INTERNAL_ERROR,   // 服务器内部错误
+        RANGE_NOT_SATISFIABLE, // 请求的范围都不可满足,跳转process_write完成416响应
+        SERVICE_UNAVAILABLE, // 服务器过载，不处理请求，回复503后关闭连接
         CLOSED_CONNECTION // 客户端已经关闭连接
     };
     enum LINE_STATUS { LINE_OK = 0, LINE_BAD, LINE_OPEN };
+    // 连接所处的阶段，每个阶段有各自的超时
+    enum TIMEOUT_PHASE {
+        PHASE_HEADER = 0, // 读取请求行和头部，从请求的第一个字节开始计时
+        PHASE_BODY,       // 读取请求体，从头部解析完开始计时
+        PHASE_IDLE,       // keep-alive连接等待下一个请求
+        PHASE_WRITE,      // 发送响应，每次有进展时重新计时
+        PHASE_NUMBER
+    };
+    // 处理请求的线程池通道，需要数据库的请求不占用静态文件的工作线程
+    enum LANE {
+        LANE_STATIC = 0, // 静态文件，不取数据库连接
+        LANE_DB,         // POST请求（登录、注册），需要数据库连接
+        LANE_NUMBER
+    };
 
   public:
-    http_conn() {}
-    ~http_conn() {}
+    http_conn()
+        : in_flight(0), m_read_buf(NULL), m_read_size(0), m_file_address(0),
+          m_cache_entry(NULL), m_file_fd(-1), m_hold_count(0) {}
+    ~http_conn() { release_read_buf(); }
 
   public:
-    void init(int sockfd, const sockaddr_in &addr);
+    void init(int sockfd, const sockaddr_in &addr, int epollfd);
     void close_conn(bool real_close = true);
     void process();
     bool read_once();
     bool write();
+    // 过载时丢弃读到的请求，回复503，发送完后关闭连接
+    void reject();
     sockaddr_in *get_address() { return &m_address; }
+    int get_sockfd() { return m_sockfd; }
+    // 响应已发送完，读缓冲区中还有未解析的流水线请求
+    bool has_buffered_request() {
+        return bytes_to_send == 0 && m_read_idx > m_checked_idx;
+    }
+    // 由读写缓冲区的状态得出当前阶段，只在连接没有被工作线程处理时调用
+    TIMEOUT_PHASE timeout_phase();
+    // 按下一个要处理的请求的方法确定通道，并记为本次处理所在的通道
+    // 由反应堆在交给线程池之前调用
+    LANE route();
+    // 下一个请求是注册而数据库熔断器断开时返回false，由反应堆直接回复503
+    bool db_admit();
+    // 工作线程处理完后调用，之后不再访问连接对象
+    void finish() { in_flight.fetch_sub(1, std::memory_order_release); }
     // 初始化数据库连接池的所有表项
-    void initmysql_result(connection_pool *connPool);
+    static void initmysql_result(connection_pool *connPool);
 
   private:
     void init();
+    void reset_request();
+    void reset_response();
+    void compact_read_buf();
+    bool grow_read_buf();
+    void release_read_buf();
+    LANE next_lane();
+    bool next_is_register();
     HTTP_CODE process_read();
     bool process_write(HTTP_CODE ret);
     HTTP_CODE parse_request_line(char *text);
     HTTP_CODE parse_headers(char *text);
     HTTP_CODE parse_content(char *text);
     HTTP_CODE do_request();
+    HTTP_CODE check_range();
+    int parse_range();
+    bool if_range_match();
+    void get_etag(char *buf, int len);
+    void get_last_modified(char *buf, int len);
+    const char *get_content_type();
     char *get_line() { return m_read_buf + m_start_line; };
     LINE_STATUS parse_line();
     void unmap();
+    void hold_file();
+    void release_files();
     bool add_response(const char *format, ...);
+    bool add_buffer_iov();
+    bool add_file_iov(char *address, size_t len);
     bool add_content(const char *content);
     bool add_status_line(int status, const char *title);
-    bool add_headers(int content_length);
-    bool add_content_type();
-    bool add_content_length(int content_length);
+    bool add_headers(off_t content_length);
+    bool add_content_type(const char *type);
+    bool add_file_headers();
+    bool add_range_response();
+    bool add_content_length(off_t content_length);
     bool add_linger();
     bool add_blank_line();
 
   public:
-    static int m_epollfd;
-    static int m_user_count;
-    MYSQL *mysql;
+    static std::atomic<int> m_user_count;
+    // 不小于该大小的文件用sendfile发送
+    static off_t m_sendfile_threshold;
+    // 注册用户的写入，只在写入时按需从连接池取连接
+    static batch_writer *m_writer;
+    // 数据库熔断器，断开期间需要写数据库的注册在反应堆中直接回复503
+    static breaker m_db_breaker;
+    util_timer timer;  // 超时定时器，随连接对象一起从slab分配，连接关闭后不在容器中
+    TIMEOUT_PHASE timer_phase; // 定时器当前按哪个阶段计时
+    LANE lane;                 // 本次处理所在的通道
+    reactor *owner;    // 分配该连接的反应堆，连接只在这个反应堆中被释放
+    // 交给线程池而工作线程还没有调用finish()的次数，不为0时反应堆不能释放连接
+    std::atomic<int> in_flight;
+    bool closing;      // 对端已关闭，等工作线程交还后释放
 
   private:
+    int m_epollfd; // 所属反应堆的内核事件表
     int m_sockfd;
     sockaddr_in m_address;
-    char m_read_buf[READ_BUFFER_SIZE];
+    // 从block_pool中取得，没有未处理的数据时归还
+    // 读缓冲区不用块链：解析出的字段和请求体都是缓冲区内的指针，要求连续；
+    // 满了才换两倍大的块并复制，最大64KB，一个请求最多复制约60KB
+    char *m_read_buf;
+    int m_read_size;
     int m_read_idx;
     int m_checked_idx;
     int m_start_line;
-    char m_write_buf[WRITE_BUFFER_SIZE];
-    int m_write_idx;
+    chain_buffer m_write_buf; // 响应头等文本，响应发送完后归还所有块
     CHECK_STATE m_check_state;
     METHOD m_method;
     char m_real_file[FILENAME_LEN]; // 实际的文件地址
     char *m_url;
     char *m_version;
     char *m_host;
+    char *m_range;    // Range头部的值
+    char *m_if_range; // If-Range头部的值
     int m_content_length;
     bool m_linger;
+    bool m_db_admitted; // 当前的注册已经在db_admit()中通过熔断器检查
     char *m_file_address;
+    file_entry *m_cache_entry; // 非空时m_file_address指向缓存内容，否则为mmap
+    int m_file_fd;      // sendfile模式下保持打开的文件，-1表示不使用sendfile
+    off_t m_file_offset; // sendfile模式下文件的发送进度
     struct stat m_file_stat;
-    struct iovec m_iv[2];
+    // 排队的响应依次追加在m_write_buf和m_iv之后，由write()一次发出
+    struct iovec m_iv[IOV_SIZE];
     int m_iv_count;
+    int m_iv_idx; // 第一个还未发送完的iovec
+    int m_resp_count;     // 已排队的响应数
+    bool m_resp_linger;   // 最后一个排队的响应是否keep-alive
+    char m_body_end_char; // 请求体后面被临时截断的字符，属于下一个请求
+    // 已排队的响应所引用的文件内容，全部发送完后统一归还
+    struct file_hold {
+        file_entry *cache_entry; // 非空时为缓存引用，否则address为mmap地址
+        char *address;
+        off_t size;
+    };
+    file_hold m_holds[MAX_PIPELINE];
+    int m_hold_count;
+    struct byte_range {
+        off_t start;
+        off_t end; // 包含
+    };
+    byte_range m_ranges[MAX_RANGES];
+    int m_range_count;
 
     // 以下是POST是需求变量
     int cgi;        // 是否启用的POST
     char *m_string; // 存储请求体数据,账号和密码
-    int bytes_to_send;
-    int bytes_have_send;
+    off_t bytes_to_send; // 文件可能超过2GB，发送长度用off_t
+    off_t bytes_have_send;
 };
 
 #endif
@@ -0,0 +1,28 @@
+#ifndef HTTP_SCAN_H
+#define HTTP_SCAN_H
+
+/*
+ * 请求报文的向量化扫描，一次比较16（SSE4.2）或32（AVX2）个字节
+ * 启动时按CPU支持的指令集选择实现，都不支持时使用逐字节的标量实现
+ * 所有函数只访问[p, end)范围内的字节，不要求以'\0'结尾
+ */
+
+// 第一个'\r'或'\n'的位置，没有时返回end
+const char *scan_line_end(const char *p, const char *end);
+
+// 第一个' '、'\t'或'\0'的位置，没有时返回end，用于切分请求行
+const char *scan_space(const char *p, const char *end);
+
+// 第一个':'或'\0'的位置，没有时返回end，用于找到头部名的结尾
+const char *scan_colon(const char *p, const char *end);
+
+enum SCAN_LEVEL { SCAN_SCALAR = 0, SCAN_SSE42, SCAN_AVX2 };
+
+// 指定使用的实现，CPU不支持时返回false且不改变当前实现，主要用于基准测试
+bool scan_select(SCAN_LEVEL level);
+// CPU支持的最高级别
+SCAN_LEVEL scan_best_level();
+// 当前实现的名称
+const char *scan_impl_name();
+
+#endif // HTTP_SCAN_H
@@ -1,9 +1,17 @@
 #ifndef LOCKER_H
 #define LOCKER_H
 
+#include <atomic>
+#include <climits>
+#include <errno.h>
 #include <exception>
+#include <linux/futex.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 
 // 信号量
 class sem {
@@ -72,4 +80,59 @@ class cond {
   private:
     pthread_cond_t m_cond;
 };
+
+/*
+ * 基于futex的线程停靠，配合无锁队列使用
+ * 等待方：prepare_wait() -> 再检查一次条件 -> 条件不满足时wait()，否则cancel_wait()
+ * 通知方：先让条件成立（如入队），再notify_one()/notify_all()
+ * 没有线程在等待时通知只读一次计数，不进入内核
+ */
+class parker {
+  public:
+    parker() : m_seq(0), m_waiters(0) {}
+
+    // 登记为等待者，返回的序号交给wait()
+    uint32_t prepare_wait() {
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+        // 之后对条件的再次检查不能提前到登记之前
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return m_seq.load(std::memory_order_seq_cst);
+    }
+    void cancel_wait() { m_waiters.fetch_sub(1, std::memory_order_relaxed); }
+    // 序号没有变化时睡眠，prepare_wait()之后的通知都会使其返回
+    // timeout_ms为-1时一直等待；超时返回false
+    bool wait(uint32_t key, int timeout_ms = -1) {
+        bool woken = true;
+        if (m_seq.load(std::memory_order_seq_cst) == key) {
+            struct timespec ts;
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+            if (syscall(SYS_futex, &m_seq, FUTEX_WAIT_PRIVATE, key,
+                        timeout_ms < 0 ? NULL : &ts, NULL, 0) < 0 &&
+                errno == ETIMEDOUT)
+                woken = false;
+        }
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+        return woken;
+    }
+
+    // 有等待者时唤醒并返回true
+    bool notify_one() { return notify(1); }
+    bool notify_all() { return notify(INT_MAX); }
+
+  private:
+    bool notify(int n) {
+        // 与等待方的prepare_wait()配对，保证不会漏掉正在准备睡眠的线程
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_waiters.load(std::memory_order_relaxed) == 0)
+            return false;
+        m_seq.fetch_add(1, std::memory_order_seq_cst);
+        syscall(SYS_futex, &m_seq, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+        return true;
+    }
+
+  private:
+    std::atomic<uint32_t> m_seq;  // 每次唤醒加一，futex在这个字上等待
+    std::atomic<int> m_waiters; // 已登记的等待者个数
+};
 #endif
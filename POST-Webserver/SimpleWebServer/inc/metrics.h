@@ -0,0 +1,99 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+
+// 每个线程池的一组计数，线程池按构造时给出的起始项加上组内偏移累加
+enum POOL_METRIC {
+    // 放入队列的请求数，以及队列已满被拒绝的请求数
+    POOL_TASKS = 0,
+    POOL_QUEUE_FULL,
+    // 持续过载期间因排队过久被丢弃的请求数
+    POOL_CODEL_DROP,
+    // 窃取模式下从其他工作线程的队列中取到的请求数
+    POOL_STEAL,
+    // 当前线程数，以及因排队时间过长新建、因空闲退出的线程数
+    POOL_THREADS,
+    POOL_GROW,
+    POOL_RETIRE,
+    POOL_METRIC_NUMBER
+};
+
+// 计数项，新增时同时在metrics.cpp的名称表中添加
+enum METRIC {
+    // 各阶段的超时次数
+    TIMEOUT_HEADER = 0,
+    TIMEOUT_BODY,
+    TIMEOUT_IDLE,
+    TIMEOUT_WRITE,
+    // 连接路径上的堆分配：slab新建的对象块，block_pool新建和释放的内存块
+    // 预热之后连接的建立和关闭都从空闲链表复用，这几项应当不再增长
+    ALLOC_SLAB_CHUNK,
+    ALLOC_BLOCK,
+    FREE_BLOCK,
+    // 数据库连接池：打开的、使用中的连接数，新建、关闭、因断开而重建、建立失败的次数
+    DB_CONN_OPEN,
+    DB_CONN_BUSY,
+    DB_CONN_CREATE,
+    DB_CONN_CLOSE,
+    DB_CONN_RECONNECT,
+    DB_CONN_FAIL,
+    // 被线程独占的连接数
+    DB_CONN_AFFINE,
+    // 新准备的预处理语句数，连接建立后每种语句只准备一次
+    DB_STMT_PREPARE,
+    // 批量写入注册用户的批次数和行数
+    DB_BATCH,
+    DB_BATCH_ROWS,
+    // 等待超时没有取到连接的次数；熔断器断开的次数，以及断开期间直接拒绝的请求数
+    DB_ACQUIRE_TIMEOUT,
+    DB_BREAKER_OPEN,
+    DB_BREAKER_REJECT,
+    // 取连接的等待时间分布：<0.1ms <1ms <10ms <100ms >=100ms
+    DB_WAIT_100US,
+    DB_WAIT_1MS,
+    DB_WAIT_10MS,
+    DB_WAIT_100MS,
+    DB_WAIT_SLOW,
+    // 取到连接时使用中的连接数占最大连接数的比例分布：<=25% <=50% <=75% <=100%
+    DB_BUSY_25,
+    DB_BUSY_50,
+    DB_BUSY_75,
+    DB_BUSY_100,
+    // 静态文件通道和数据库通道的线程池各一组，组内的顺序与POOL_METRIC相同
+    STATIC_POOL_METRICS,
+    DB_POOL_METRICS = STATIC_POOL_METRICS + POOL_METRIC_NUMBER,
+    METRIC_NUMBER = DB_POOL_METRICS + POOL_METRIC_NUMBER
+};
+
+/*
+ * 进程内共享的运行计数，各线程直接原子累加，不加锁
+ * 由主反应堆定期、以及程序退出时写入日志
+ */
+class metrics {
+  public:
+    // C++11以后,使用局部静态变量实现单例模式不用加锁
+    static metrics *get_instance() {
+        static metrics instance;
+        return &instance;
+    }
+
+    void add(METRIC m, long long n = 1) {
+        m_counters[m].fetch_add(n, std::memory_order_relaxed);
+    }
+    long long get(METRIC m) {
+        return m_counters[m].load(std::memory_order_relaxed);
+    }
+    static const char *name(METRIC m);
+
+    // 把所有计数写成一行日志
+    void report();
+
+  private:
+    metrics();
+
+  private:
+    std::atomic<long long> m_counters[METRIC_NUMBER];
+};
+
+#endif // METRICS_H
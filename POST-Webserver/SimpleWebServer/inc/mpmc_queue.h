@@ -0,0 +1,111 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <atomic>
+#include <stddef.h>
+
+/*
+ * 有界的多生产者多消费者无锁环形队列（Dmitry Vyukov的算法）
+ * 1. 每个槽位有一个序号，生产者和消费者各自用CAS抢占位置，
+ *    抢到后只写自己的槽位，再通过序号把槽位交给对方
+ * 2. 入队出队都不分配内存；队列满或空时立即返回false，不等待
+ * 3. 入队位置和出队位置放在不同的缓存行，避免生产者和消费者互相干扰
+ * 容量向上取整为2的幂；T需要可以直接赋值，线程池中为请求指针
+ */
+template <typename T> class mpmc_queue {
+  public:
+    explicit mpmc_queue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity)
+            size <<= 1;
+        m_mask = size - 1;
+        m_cells = new cell[size];
+        for (size_t i = 0; i < size; ++i)
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+        m_enqueue_pos.store(0, std::memory_order_relaxed);
+        m_dequeue_pos.store(0, std::memory_order_relaxed);
+    }
+    ~mpmc_queue() { delete[] m_cells; }
+
+    size_t capacity() const { return m_mask + 1; }
+
+    // 队列满时返回false
+    bool push(const T &data) {
+        cell *c;
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            c = &m_cells[pos & m_mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            long diff = (long)seq - (long)pos;
+            if (diff == 0) {
+                // 槽位空闲，抢占这个入队位置
+                if (m_enqueue_pos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                // 槽位中的数据还没有被取走，队列已满
+                return false;
+            } else {
+                // 位置已经被其他生产者占用
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        c->data = data;
+        c->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 队列空时返回false
+    bool pop(T &data) {
+        cell *c;
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            c = &m_cells[pos & m_mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            long diff = (long)seq - (long)(pos + 1);
+            if (diff == 0) {
+                if (m_dequeue_pos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                // 槽位还没有写入数据，队列为空
+                return false;
+            } else {
+                pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        data = c->data;
+        // 序号推进一圈，槽位交还给下一轮的生产者
+        c->seq.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 近似的元素个数，只用于统计
+    size_t size() const {
+        size_t tail = m_enqueue_pos.load(std::memory_order_relaxed);
+        size_t head = m_dequeue_pos.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+  private:
+    mpmc_queue(const mpmc_queue &);
+    mpmc_queue &operator=(const mpmc_queue &);
+
+    static const size_t CACHE_LINE = 64;
+    struct cell {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+  private:
+    char m_pad0[CACHE_LINE];
+    cell *m_cells;
+    size_t m_mask;
+    char m_pad1[CACHE_LINE - sizeof(cell *) - sizeof(size_t)];
+    std::atomic<size_t> m_enqueue_pos;
+    char m_pad2[CACHE_LINE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> m_dequeue_pos;
+    char m_pad3[CACHE_LINE - sizeof(std::atomic<size_t>)];
+};
+
+#endif // MPMC_QUEUE_H
@@ -0,0 +1,58 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <atomic>
+#include <vector>
+
+/*
+ * 线程的CPU与NUMA节点布局
+ * 1. 启动时从/sys/devices/system/node读取每个NUMA节点的CPU，没有NUMA信息时视为一个节点
+ * 2. 按配置把反应堆线程和工作线程依次绑定到给定的CPU上，每个线程一个CPU，线程多于CPU时轮流使用
+ * 3. 绑定后把线程的内存分配策略设为优先使用该CPU所在的节点，
+ *    线程此后首次访问的内存（连接对象、缓冲区）都在本地节点
+ * 没有配置时不绑定，保持原来由调度器决定的行为
+ */
+class placement {
+  public:
+    // C++11以后,使用局部静态变量实现单例模式不用加锁
+    static placement *get_instance() {
+        static placement instance;
+        return &instance;
+    }
+
+    // 读取CPU和NUMA拓扑，在创建任何线程之前调用
+    void init();
+    // 解析"反应堆CPU列表/工作线程CPU列表"，CPU列表的格式与/sys相同，如"0-1/2-7,16"
+    // 两部分都可以为空，CPU不存在时返回false
+    bool configure(const char *spec);
+    // 把检测到的拓扑和配置写入日志
+    void log_topology();
+
+    // 在线程开始运行时调用，把当前线程绑定到下一个配置的CPU
+    void bind_reactor();
+    void bind_worker();
+
+    int node_number() const { return m_node_number; }
+    // 当前线程绑定的NUMA节点，没有绑定时为0
+    static int current_node() { return t_node; }
+
+  private:
+    placement();
+
+    void bind(const std::vector<int> &cpus, std::atomic<int> &next,
+              const char *role);
+    int node_of(int cpu) const;
+
+  private:
+    int m_cpu_number;
+    int m_node_number;
+    std::vector<int> m_cpu_node;                  // 每个CPU所在的节点
+    std::vector<std::vector<int> > m_node_cpus;   // 按节点编号，每个节点的CPU
+    std::vector<int> m_reactor_cpus;
+    std::vector<int> m_worker_cpus;
+    std::atomic<int> m_next_reactor;
+    std::atomic<int> m_next_worker;
+    static thread_local int t_node;
+};
+
+#endif // PLACEMENT_H
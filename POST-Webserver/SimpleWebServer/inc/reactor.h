@@ -0,0 +1,78 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+
+#include "heap_timer.h"
+#include "http_conn.h"
+#include "slab.h"
+#include "sql_connection_pool.h"
+#include "threadpool.h"
+
+#define MAX_EVENT_NUMBER 10000 // 最大事件数
+#define METRICS_INTERVAL 60000 // 主反应堆输出运行计数的间隔，单位毫秒
+#define CLOSE_RETRY_MS 10      // 连接还在工作线程中时，推迟释放的间隔，单位毫秒
+
+/*
+ * 反应堆：一个epoll内核事件表 + 一个监听socket + 一个定时器容器
+ * 1. 半同步/半反应堆模式：只有一个反应堆，读写在反应堆线程，解析交给线程池
+ * 2. one loop per thread模式：多个反应堆，每个反应堆有自己的SO_REUSEPORT监听
+ *    socket，由内核分发新连接，读、解析、写都在本线程完成
+ * 连接对象在accept时从本反应堆的slab中分配，事件的data.ptr直接指向连接对象，
+ * 在关闭连接的定时器回调或deal_close中放回slab，都在反应堆线程中进行；
+ * 连接交给线程池后到工作线程调用finish()之前不放回，超时和关闭都推迟处理
+ */
+class reactor {
+  public:
+    // max_conns为所有反应堆合计的最大连接数；pools按通道给出线程池，
+    // 为NULL时，请求直接在反应堆线程中处理
+    reactor(int listenfd, int max_conns, threadpool<http_conn> **pools);
+    ~reactor();
+
+    // 由主线程运行的反应堆负责处理signalfd
+    void set_signal_fd(int sigfd);
+    // 唤醒阻塞在等待中的事件循环，用于退出
+    void wakeup();
+
+    // 在当前线程运行事件循环，直到收到SIGTERM
+    void loop();
+    // 新建线程运行事件循环
+    bool start();
+    void join();
+
+    // 所有反应堆共用的退出标志
+    static volatile bool m_stop_server;
+    // 各阶段的超时，单位毫秒，在启动反应堆之前设置
+    static int m_timeouts[http_conn::PHASE_NUMBER];
+
+  private:
+    static void *worker(void *arg);
+    static void cb_func(http_conn *conn);
+    static void release_conn(http_conn *conn);
+    void deal_accept();
+    void deal_signal();
+    void deal_wakeup();
+    void deal_read(http_conn *conn);
+    void deal_write(http_conn *conn);
+    void dispatch(http_conn *conn);
+    void deal_close(http_conn *conn);
+    void adjust_timer(http_conn *conn);
+
+  private:
+    int m_epollfd;
+    int m_listenfd;
+    int m_sigfd;  // signalfd，-1表示本反应堆不处理信号
+    int m_wakefd; // eventfd，其他线程通过它唤醒本反应堆
+    pthread_t m_thread;
+    int m_max_conns;
+    slab<http_conn> m_conns; // 本反应堆的连接对象
+    // 每个通道的线程池，NULL表示在反应堆线程中处理
+    threadpool<http_conn> *m_pools[http_conn::LANE_NUMBER];
+    HeapTimer m_timer_lst; // 本反应堆的定时器容器，最早的到期时间决定等待的超时
+    long long m_next_report; // 下一次输出运行计数的时间，只有处理信号的反应堆输出
+    epoll_event m_events[MAX_EVENT_NUMBER];
+};
+
+#endif // REACTOR_H
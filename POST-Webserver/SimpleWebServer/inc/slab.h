@@ -0,0 +1,64 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <vector>
+
+#include "metrics.h"
+
+/*
+ * 定长对象的slab分配器，按块批量创建对象，用完放回空闲栈复用
+ * 1. 只在需要时才创建新块，连接数少时不占用内存
+ * 2. 对象地址在slab销毁前不变，可以放进epoll_event.data.ptr
+ * 3. 最近释放的对象最先被复用，它的内存大概率还在缓存中
+ * 不加锁，只能由一个线程分配和释放
+ */
+template <typename T> class slab {
+  public:
+    // max_objects为对象总数上限，每块objects_per_chunk个对象
+    slab(int max_objects, int objects_per_chunk = 256)
+        : m_max_objects(max_objects), m_per_chunk(objects_per_chunk),
+          m_capacity(0) {}
+    ~slab() {
+        for (size_t i = 0; i < m_chunks.size(); ++i)
+            delete[] m_chunks[i];
+    }
+
+    // 达到上限时返回NULL
+    T *alloc() {
+        if (m_free.empty() && !grow())
+            return NULL;
+        T *obj = m_free.back();
+        m_free.pop_back();
+        return obj;
+    }
+    void free(T *obj) { m_free.push_back(obj); }
+
+    // 正在使用的对象个数
+    int used() const { return m_capacity - (int)m_free.size(); }
+
+  private:
+    bool grow() {
+        int n = m_max_objects - m_capacity;
+        if (n <= 0)
+            return false;
+        if (n > m_per_chunk)
+            n = m_per_chunk;
+        T *chunk = new T[n];
+        m_chunks.push_back(chunk);
+        metrics::get_instance()->add(ALLOC_SLAB_CHUNK);
+        // 倒序压栈，先分配块中靠前的对象
+        for (int i = n - 1; i >= 0; --i)
+            m_free.push_back(chunk + i);
+        m_capacity += n;
+        return true;
+    }
+
+  private:
+    int m_max_objects;
+    int m_per_chunk;
+    int m_capacity; // 已创建的对象个数
+    std::vector<T *> m_chunks;
+    std::vector<T *> m_free;
+};
+
+#endif // SLAB_H
@@ -12,12 +12,38 @@
 
 using namespace std;
 
+/*
+ * 可伸缩的数据库连接池
+ * 1. 启动时建立MinConn条连接，一直保持；都在使用时按需新建，最多MaxConn条
+ * 2. 后台线程每PingInterval秒ping一次空闲较久的连接，断开的连接重新建立，
+ *    连接数不足MinConn时（如启动时数据库不可用）补足
+ * 3. 多出MinConn的连接空闲IdleTimeout秒后关闭
+ * 4. 取出空闲超过CHECK_IDLE_MS的连接时先ping，归还时发现连接已断开（数据库重启）
+ *    就关闭它，下次按需新建，调用方不会拿到已断开的连接
+ * 5. 取连接最多等待AcquireTimeout毫秒，数据库停顿、连接都被占用时调用方不会一直阻塞
+ * 6. 线程独占模式：线程第一次取到的连接留给该线程长期使用，保存在线程局部变量中，
+ *    之后取还连接都不加锁；连接断开时再从共享池中换一条。独占的连接也计入MaxConn，
+ *    且至少留一条给共享池，取连接的线程数多于MaxConn-1时，多出的线程轮流使用共享池
+ * 7. 每条连接缓存自己的预处理语句，第一次使用时准备，连接关闭时一起释放
+ */
 class connection_pool {
   public:
-    MYSQL *GetConnection();              // 获取数据库连接
+    static const int CHECK_IDLE_MS = 1000; // 空闲超过该时间的连接取出时先检查
+    static const int MAX_STATEMENTS = 16;  // 每条连接缓存的预处理语句数
+
+    MYSQL *GetConnection(); // 获取数据库连接，连不上数据库或等待超时时返回NULL
     bool ReleaseConnection(MYSQL *conn); // 释放连接
     int GetFreeConn();                   // 获取连接
     void DestroyPool();                  // 销毁所有连接
+    // 取连接最多等待的毫秒数，-1表示一直等待
+    void SetAcquireTimeout(int ms) { AcquireTimeout = ms; }
+    // 开启线程独占模式，在有线程取连接之前调用
+    void SetThreadAffine(bool on) { ThreadAffine = on; }
+    // 把当前线程独占的连接还给共享池，线程退出时自动调用
+    void ReleaseThread();
+    // 取连接上编号为id的预处理语句，第一次使用时用sql准备，失败返回NULL
+    // 同一编号总是对应同一条sql，只能用于从本连接池取出的连接
+    static MYSQL_STMT *Prepare(MYSQL *con, int id, const char *sql);
 
     // 单例模式
     static connection_pool *GetInstance();
@@ -26,27 +52,64 @@ class connection_pool {
     connection_pool(const connection_pool &) = delete;
     connection_pool &operator=(const connection_pool &) = delete;
 
-    // mysql连接池初始化
+    // mysql连接池初始化，并启动后台维护线程
     void init(string url, string User, string PassWord, string DataBaseName,
-              int Port, unsigned int MaxConn);
+              int Port, unsigned int MinConn, unsigned int MaxConn,
+              int IdleTimeout = 60, int PingInterval = 30);
 
   private:
     connection_pool();
     ~connection_pool();
 
+    MYSQL *Connect();             // 新建一条连接，失败返回NULL
+    void Close(MYSQL *con);       // 关闭一条连接
+    static void *keeper(void *arg);
+    void Keep();                  // 后台维护：ping、重连、关闭多余的空闲连接
+    static long long NowUs();
+
   private:
+    unsigned int MinConn;  // 保持的最少连接数
     unsigned int MaxConn;  // 最大连接数
     unsigned int CurConn;  // 当前已使用的连接数
     unsigned int FreeConn; // 当前空闲的连接数
+    unsigned int Pending;  // 正在建立或检查的连接数，也计入连接总数
+    int IdleTimeout;       // 多余的空闲连接保留的秒数
+    int PingInterval;      // 后台检查的间隔秒数
+    int AcquireTimeout;    // 取连接最多等待的毫秒数
+    bool ThreadAffine;     // 是否开启线程独占模式
+    unsigned int Adopted;  // 被线程独占的连接数，计入CurConn
 
   private:
-    locker lock;            // 互斥锁
-    list<MYSQL *> connList; // MYSQL连接池
-    sem reserve; // 可用连接的信号量，其实是和FreeConn重复了
+    // 连接和它的预处理语句，MYSQL放在开头，取出的MYSQL *可以转换回来
+    struct pooled_conn {
+        MYSQL mysql;
+        MYSQL_STMT *stmts[MAX_STATEMENTS];
+    };
+    // 空闲连接和开始空闲的时间，归还的放到末尾，从末尾取，开头是空闲最久的
+    struct idle_conn {
+        MYSQL *con;
+        long long since;
+    };
+    locker lock;               // 互斥锁
+    list<idle_conn> connList;  // MYSQL连接池
+    cond released;             // 有连接归还或连接数减少时通知等待的线程
+    cond stopping;             // 通知后台线程退出
+    pthread_t m_keeper;
+    bool m_started;
+    bool m_stop;
+
+    // 线程独占的连接，线程退出时还给共享池
+    struct thread_conn {
+        MYSQL *con;
+        bool busy;      // 是否正被本线程使用
+        long long since; // 上次归还的时间
+        ~thread_conn();
+    };
+    static thread_local thread_conn t_conn;
 
   private:
     string url;          // 主机地址
-    string Port;         // 数据库端口号
+    int Port;            // 数据库端口号
     string User;         // 登陆数据库用户名
     string PassWord;     // 登陆数据库密码
     string DatabaseName; // 使用数据库名
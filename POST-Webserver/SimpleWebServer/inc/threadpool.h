@@ -1,102 +1,311 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 
-#include "sql_connection_pool.h"
+#include "codel.h"
 #include "locker.h"
+#include "log.h"
+#include "metrics.h"
+#include "mpmc_queue.h"
+#include "placement.h"
+#include <atomic>
 #include <cstdio>
 #include <exception>
-#include <list>
 #include <pthread.h>
+#include <time.h>
+#include <utility>
+#include <vector>
 
+// 请求的分配方式
+enum SCHEDULE {
+    SCHEDULE_SHARED = 0, // 所有工作线程共用一个请求队列
+    SCHEDULE_STEALING    // 每个工作线程一个队列，按fd分配，空闲线程从其他队列窃取
+};
+
+/*
+ * 请求队列为无锁的有界环形队列，入队出队不加锁、不分配内存
+ * 空闲的工作线程通过futex停靠，只有存在睡眠的线程时入队才会进入内核唤醒
+ * 窃取模式下同一个连接的请求总是先交给同一个工作线程，连接对象留在该线程的缓存中；
+ * 该线程忙碌时唤醒一个空闲线程，由它从队列中窃取
+ *
+ * 线程数在[thread_number, max_thread_number]之间伸缩：
+ * 1. 请求入队时记下时间，工作线程取出请求时发现排队时间超过GROW_SOJOURN_US，
+ *    说明现有线程处理不过来，新建一个线程，两次新建至少间隔GROW_INTERVAL_US
+ * 2. 按排队时间而不是队列长度判断，突发的大量短请求不会引起扩容
+ * 3. 超出最小线程数的线程空闲idle_timeout_ms后退出
+ * 静态文件请求和数据库请求各用一个线程池，互不阻塞，各自限制队列长度并分开计数
+ * 过载时的处理：队列满时append()返回false，由调用方拒绝请求；
+ * 开启codel后，持续过载期间排队过久的请求在取出时直接回复503，不再处理
+ * 请求处理或拒绝后调用finish()，通知调用方工作线程不再访问它
+ */
 template <typename T> class threadpool {
   public:
-    /*connPool是数据库连接池指针，必须指定；
-    thread_number是线程池中线程的数量，一般和数据库连接池的大小一致；
-    max_requests是请求队列中最多允许的、等待处理的请求的数量*/
-    threadpool(connection_pool *connPool, int thread_number = 8,
-               int max_request = 10000);
+    static const long long GROW_SOJOURN_US = 5000;   // 触发扩容的排队时间
+    static const long long GROW_INTERVAL_US = 20000; // 两次扩容的最小间隔
+
+    /*thread_number是线程池中常驻线程的数量；
+    max_requests是请求队列中最多允许的、等待处理的请求的数量，
+    窃取模式下平分到每个常驻线程的队列，每个队列的容量向上取整为2的幂；
+    max_thread_number是扩容后的最大线程数，不大于thread_number时线程数固定；
+    idle_timeout_ms是超出常驻数量的线程空闲多久后退出；
+    metric_base是本线程池的一组计数在METRIC中的起始项*/
+    threadpool(int thread_number = 8,
+               int max_request = 10000,
+               SCHEDULE schedule = SCHEDULE_SHARED,
+               int max_thread_number = 0, int idle_timeout_ms = 30000,
+               METRIC metric_base = STATIC_POOL_METRICS);
     ~threadpool();
+    // 队列已满时返回false
     bool append(T *request);
+    // 开启按排队时间丢弃请求，在有请求到达之前调用
+    void set_codel(long long target_us, long long interval_us);
 
   private:
     /*工作线程运行的函数，它不断从工作队列中取出任务并执行之,
     必须是静态成员函数，因为普通成员函数隐含地包含了一个 this*/
+    struct task;
     static void *worker(void *arg);
-    void run();
+    void run(int id);
+    // 先取自己的队列，再依次窃取其他队列
+    bool take(int queue, task &t);
+    bool spawn();
+    void shutdown();
+    void maybe_grow(long long now);
+    void count(POOL_METRIC m, long long n = 1) {
+        metrics::get_instance()->add((METRIC)(m_metric_base + m), n);
+    }
+    static long long now_us() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    }
 
   private:
-    int m_thread_number; // 线程池中的线程数
+    // 请求和入队时间
+    struct task {
+        T *request;
+        long long enqueue_us;
+    };
+    // 一个请求队列和在它上面睡眠的工作线程，各队列分开分配，不共享缓存行
+    struct work_queue {
+        explicit work_queue(size_t capacity) : requests(capacity) {}
+        mpmc_queue<task> requests;
+        parker park;
+    };
+
+    int m_thread_number; // 常驻线程数
+    int m_max_thread_number; // 最大线程数
+    int m_idle_timeout_ms;
     int m_max_requests;  // 请求队列中允许的最大请求数
-    pthread_t *m_threads; // 描述线程池的数组，其大小为m_thread_number
-    std::list<T *> m_workqueue;  // 请求队列
-    locker m_queuelocker;        // 保护请求队列的互斥锁
-    sem m_queuestat;             // 是否有任务需要处理
-    bool m_stop;                 // 是否结束线程
-    connection_pool *m_connPool; // 数据库
+    pthread_t *m_threads; // 描述线程池的数组，其大小为m_max_thread_number
+    work_queue **m_queues;       // 请求队列，共用模式下只有一个
+    int m_queue_number;
+    // 空闲的线程编号，编号小于m_thread_number的是常驻线程，不会退出
+    std::vector<int> m_free_ids;
+    locker m_id_lock;
+    cond m_exited;                      // 线程退出时通知析构函数
+    std::atomic<int> m_live_threads;   // 当前的线程数
+    std::atomic<long long> m_last_grow; // 上次扩容的时间
+    codel *m_codel;                     // 为NULL时不按排队时间丢弃
+    METRIC m_metric_base;
+    std::atomic<bool> m_stop;    // 是否结束线程
 };
 
 template <typename T>
-threadpool<T>::threadpool(connection_pool *connPool, int thread_number,
-                          int max_requests)
-    : m_thread_number(thread_number), m_max_requests(max_requests),
-      m_stop(false), m_threads(NULL), m_connPool(connPool) {
-    if (thread_number <= 0 || max_requests <= 0)
+threadpool<T>::threadpool(int thread_number,
+                          int max_requests, SCHEDULE schedule,
+                          int max_thread_number, int idle_timeout_ms,
+                          METRIC metric_base)
+    : m_thread_number(thread_number),
+      m_max_thread_number(max_thread_number > thread_number
+                              ? max_thread_number
+                              : thread_number),
+      m_idle_timeout_ms(idle_timeout_ms), m_max_requests(max_requests),
+      m_threads(NULL), m_queues(NULL), m_queue_number(0), m_live_threads(0),
+      m_last_grow(0), m_codel(NULL), m_metric_base(metric_base), m_stop(false) {
+    if (thread_number <= 0 || max_requests <= 0 || idle_timeout_ms <= 0)
         throw std::exception();
-    m_threads = new pthread_t[m_thread_number];
+    m_queue_number = schedule == SCHEDULE_STEALING ? thread_number : 1;
+    m_queues = new work_queue *[m_queue_number];
+    for (int i = 0; i < m_queue_number; ++i)
+        m_queues[i] = new work_queue(
+            (max_requests + m_queue_number - 1) / m_queue_number);
+    m_threads = new pthread_t[m_max_thread_number];
     if (!m_threads)
         throw std::exception();
+    // 倒序压栈，常驻线程先取到较小的编号
+    for (int i = m_max_thread_number - 1; i >= 0; --i)
+        m_free_ids.push_back(i);
 
-    // 创建子线程，并设置为脱离线程
+    // 创建常驻线程
     for (int i = 0; i < thread_number; ++i) {
-        if (pthread_create(m_threads + i, NULL, worker, this) != 0) {
-            delete[] m_threads;
-            throw std::exception();
-        }
-        if (pthread_detach(m_threads[i])) {
-            delete[] m_threads;
+        if (!spawn()) {
+            shutdown();
             throw std::exception();
         }
     }
 }
-template <typename T> threadpool<T>::~threadpool() {
+template <typename T> threadpool<T>::~threadpool() { shutdown(); }
+// 通知所有线程退出，等正在处理的请求完成、线程都退出后再释放队列
+// 队列中尚未处理的请求直接丢弃
+template <typename T> void threadpool<T>::shutdown() {
+    m_stop.store(true);
+    for (int i = 0; i < m_queue_number; ++i)
+        m_queues[i]->park.notify_all();
+    m_id_lock.lock();
+    while (m_live_threads.load() > 0)
+        m_exited.wait(m_id_lock.get());
+    m_id_lock.unlock();
+
+    for (int i = 0; i < m_queue_number; ++i)
+        delete m_queues[i];
+    delete[] m_queues;
+    delete m_codel;
     delete[] m_threads;
-    m_stop = true;
 }
 template <typename T> bool threadpool<T>::append(T *request) {
-    m_queuelocker.lock();
-    if (m_workqueue.size() > m_max_requests) {
-        m_queuelocker.unlock();
+    int target = m_queue_number > 1 ? request->get_sockfd() % m_queue_number
+                                    : 0;
+    task t = {request, now_us()};
+    if (!m_queues[target]->requests.push(t)) {
+        count(POOL_QUEUE_FULL);
         return false;
     }
-    m_workqueue.push_back(request);
-    m_queuelocker.unlock();
-    m_queuestat.post();
+    count(POOL_TASKS);
+    if (m_queues[target]->park.notify_one())
+        return true;
+    // 目标线程正忙，唤醒一个空闲线程来窃取
+    for (int i = 1; i < m_queue_number; ++i) {
+        if (m_queues[(target + i) % m_queue_number]->park.notify_one())
+            break;
+    }
     return true;
 }
+template <typename T>
+void threadpool<T>::set_codel(long long target_us, long long interval_us) {
+    m_codel = new codel(target_us, interval_us);
+}
+// 取一个空闲编号，新建线程并设置为脱离线程
+template <typename T> bool threadpool<T>::spawn() {
+    m_id_lock.lock();
+    if (m_free_ids.empty()) {
+        m_id_lock.unlock();
+        return false;
+    }
+    int id = m_free_ids.back();
+    m_free_ids.pop_back();
+    m_id_lock.unlock();
+
+    std::pair<threadpool *, int> *arg =
+        new std::pair<threadpool *, int>(this, id);
+    // 先计入线程数，新线程立即退出时析构函数也会等它
+    m_live_threads.fetch_add(1);
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, worker, arg) != 0) {
+        delete arg;
+        m_live_threads.fetch_sub(1);
+        m_id_lock.lock();
+        m_free_ids.push_back(id);
+        m_id_lock.unlock();
+        return false;
+    }
+    pthread_detach(tid);
+    m_threads[id] = tid;
+    count(POOL_THREADS);
+    return true;
+}
+// 排队时间过长时扩容，多个线程同时发现时只有一个能成功
+template <typename T> void threadpool<T>::maybe_grow(long long now) {
+    if (m_stop.load() ||
+        m_live_threads.load(std::memory_order_relaxed) >= m_max_thread_number)
+        return;
+    long long last = m_last_grow.load(std::memory_order_relaxed);
+    if (now - last < GROW_INTERVAL_US ||
+        !m_last_grow.compare_exchange_strong(last, now))
+        return;
+    if (spawn()) {
+        count(POOL_GROW);
+        LOG_INFO("threadpool grow to %d threads",
+                 m_live_threads.load(std::memory_order_relaxed));
+        Log::get_instance()->flush();
+    }
+}
 template <typename T> void *threadpool<T>::worker(void *arg) {
-    threadpool *pool = (threadpool *)arg;
-    pool->run();
+    std::pair<threadpool *, int> *p = (std::pair<threadpool *, int> *)arg;
+    threadpool *pool = p->first;
+    int id = p->second;
+    delete p;
+    pool->run(id);
     return pool;
 }
-template <typename T> void threadpool<T>::run() {
+template <typename T> bool threadpool<T>::take(int queue, task &t) {
+    if (m_queues[queue]->requests.pop(t))
+        return true;
+    for (int i = 1; i < m_queue_number; ++i) {
+        if (m_queues[(queue + i) % m_queue_number]->requests.pop(t)) {
+            count(POOL_STEAL);
+            return true;
+        }
+    }
+    return false;
+}
+template <typename T> void threadpool<T>::run(int id) {
+    placement::get_instance()->bind_worker();
+    // 扩容出的线程编号大于常驻线程，与常驻线程共用队列
+    int queue = id % m_queue_number;
+    parker &park = m_queues[queue]->park;
+    bool resident = id < m_thread_number;
+    long long last_work = now_us();
     while (!m_stop) {
-        // 等待需要处理的信号量
-        m_queuestat.wait();
-        m_queuelocker.lock();
-        if (m_workqueue.empty()) {
-            m_queuelocker.unlock();
-            continue;
+        task t;
+        if (!take(queue, t)) {
+            long long idle_ms = (now_us() - last_work) / 1000;
+            if (!resident && idle_ms >= m_idle_timeout_ms)
+                break;
+            // 登记为等待者后再检查一次队列和退出标志，避免错过登记前的通知
+            uint32_t key = park.prepare_wait();
+            if (m_stop.load()) {
+                park.cancel_wait();
+                break;
+            }
+            if (take(queue, t)) {
+                park.cancel_wait();
+            } else {
+                park.wait(key, resident ? -1 : m_idle_timeout_ms - idle_ms);
+                continue;
+            }
         }
-        T *request = m_workqueue.front();
-        m_workqueue.pop_front();
-        m_queuelocker.unlock();
+        long long now = now_us();
+        long long sojourn = now - t.enqueue_us;
+        last_work = now;
+        if (sojourn > GROW_SOJOURN_US)
+            maybe_grow(now);
+        T *request = t.request;
         if (!request)
             continue;
-
-        // 取一个sql连接,给http连接
-        connectionRAII mysqlcon(&request->mysql, m_connPool);
+        if (m_codel && m_codel->should_drop(sojourn, now)) {
+            count(POOL_CODEL_DROP);
+            request->reject();
+            request->finish();
+            continue;
+        }
 
         request->process();
+        request->finish();
+    }
+    // 空闲超时时归还编号；析构时等线程数归零，解锁之后不能再访问线程池
+    bool retire = !m_stop.load();
+    count(POOL_THREADS, -1);
+    if (retire)
+        count(POOL_RETIRE);
+    m_id_lock.lock();
+    int live = m_live_threads.fetch_sub(1) - 1;
+    if (retire)
+        m_free_ids.push_back(id);
+    m_exited.signal();
+    m_id_lock.unlock();
+    if (retire) {
+        LOG_INFO("threadpool idle thread retire, %d threads", live);
+        Log::get_instance()->flush();
     }
 }
 #endif
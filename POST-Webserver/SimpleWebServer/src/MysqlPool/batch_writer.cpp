@@ -0,0 +1,150 @@
+#include <mysql/errmsg.h>
+#include <mysql/mysql.h>
+#include <string.h>
+
+#include "batch_writer.h"
+#include "heap_timer.h"
+#include "log.h"
+#include "metrics.h"
+
+batch_writer::batch_writer()
+    : m_pool(NULL), m_breaker(NULL), m_max_rows(1), m_started(false),
+      m_stop(false) {
+    // n行的语句为INSERT ... VALUES(?, ?),(?, ?)...，只有一行时与单行插入相同
+    std::string sql = "INSERT INTO user(username, passwd) VALUES(?, ?)";
+    for (int i = 0; i < MAX_ROWS; ++i) {
+        m_sql[i] = sql;
+        sql += ",(?, ?)";
+    }
+}
+
+batch_writer::~batch_writer() { stop(); }
+
+bool batch_writer::init(connection_pool *pool, breaker *db_breaker,
+                        int max_rows) {
+    m_pool = pool;
+    m_breaker = db_breaker;
+    m_max_rows = max_rows < MAX_ROWS ? max_rows : MAX_ROWS;
+    if (m_max_rows <= 1)
+        return true;
+    if (pthread_create(&m_thread, NULL, worker, this) != 0) {
+        LOG_ERROR("%s", "create batch writer failure");
+        Log::get_instance()->flush();
+        return false;
+    }
+    m_started = true;
+    return true;
+}
+
+int batch_writer::insert(const char *name, const char *password) {
+    row r = {name, password, 1, false};
+    row *rows[1] = {&r};
+    if (!m_started) {
+        write(rows, 1);
+        return r.res;
+    }
+
+    m_lock.lock();
+    m_queue.push_back(&r);
+    m_ready.signal();
+    while (!r.done)
+        m_done.wait(m_lock.get());
+    m_lock.unlock();
+    return r.res;
+}
+
+void batch_writer::stop() {
+    if (!m_started)
+        return;
+    m_lock.lock();
+    m_stop = true;
+    m_ready.signal();
+    m_lock.unlock();
+    pthread_join(m_thread, NULL);
+    m_started = false;
+}
+
+void *batch_writer::worker(void *arg) {
+    batch_writer *writer = (batch_writer *)arg;
+    writer->run();
+    return writer;
+}
+
+// 队列为空时睡眠，否则一次取出最多m_max_rows行写入，写入时不持有锁
+void batch_writer::run() {
+    row *rows[MAX_ROWS];
+    m_lock.lock();
+    while (true) {
+        while (m_queue.empty() && !m_stop)
+            m_ready.wait(m_lock.get());
+        if (m_queue.empty())
+            break;
+        int n = 0;
+        while (n < m_max_rows && !m_queue.empty()) {
+            rows[n++] = m_queue.front();
+            m_queue.pop_front();
+        }
+        m_lock.unlock();
+
+        write(rows, n);
+
+        m_lock.lock();
+        for (int i = 0; i < n; ++i)
+            rows[i]->done = true;
+        m_done.broadcast();
+    }
+    m_lock.unlock();
+}
+
+void batch_writer::write(row **rows, int n) {
+    // 只在这里取数据库连接，离开作用域时归还
+    MYSQL *mysql = NULL;
+    connectionRAII mysqlcon(&mysql, m_pool);
+    // 错误返回非零值，连不上数据库时按注册失败处理
+    long long begin = timer_now_ms();
+    int res = mysql ? execute(mysql, rows, n) : 1;
+    // 取不到连接、连接错误和慢查询计入熔断器，重名等SQL错误不算
+    bool ok = mysql && (!res || mysql_errno(mysql) < CR_MIN_ERROR);
+    if (res && ok && n > 1) {
+        // 整批因SQL错误失败，逐行重写找出出错的行
+        for (int i = 0; i < n; ++i) {
+            rows[i]->res = execute(mysql, rows + i, 1);
+            if (rows[i]->res && mysql_errno(mysql) >= CR_MIN_ERROR)
+                ok = false;
+        }
+    } else {
+        for (int i = 0; i < n; ++i)
+            rows[i]->res = res;
+    }
+    long long elapsed = timer_now_ms() - begin;
+    metrics::get_instance()->add(DB_BATCH);
+    metrics::get_instance()->add(DB_BATCH_ROWS, n);
+
+    if (m_breaker && m_breaker->record(ok, elapsed)) {
+        metrics::get_instance()->add(DB_BREAKER_OPEN);
+        LOG_ERROR("%s", "mysql breaker open");
+        Log::get_instance()->flush();
+    }
+}
+
+int batch_writer::execute(MYSQL *mysql, row **rows, int n) {
+    // 语句在连接上只准备一次，之后每批只发送参数
+    MYSQL_STMT *stmt =
+        connection_pool::Prepare(mysql, n - 1, m_sql[n - 1].c_str());
+    if (stmt == NULL)
+        return 1;
+    unsigned long lengths[MAX_ROWS * 2];
+    MYSQL_BIND bind[MAX_ROWS * 2];
+    memset(bind, 0, sizeof(bind[0]) * n * 2);
+    for (int i = 0; i < n * 2; ++i) {
+        const char *value = i % 2 ? rows[i / 2]->password : rows[i / 2]->name;
+        lengths[i] = strlen(value);
+        bind[i].buffer_type = MYSQL_TYPE_STRING;
+        bind[i].buffer = (void *)value;
+        bind[i].buffer_length = lengths[i];
+        bind[i].length = &lengths[i];
+    }
+    if (mysql_stmt_bind_param(stmt, bind))
+        return 1;
+    return mysql_stmt_execute(stmt);
+}
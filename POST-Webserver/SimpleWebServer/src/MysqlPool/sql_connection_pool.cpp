@@ -1,18 +1,36 @@
 #include <mysql/mysql.h>
+#include <mysql/errmsg.h>
 #include <stdio.h>
 #include <string>
 #include <string.h>
 #include <stdlib.h>
 #include <list>
 #include <pthread.h>
+#include <time.h>
 #include <iostream>
+#include "log.h"
+#include "metrics.h"
 #include "sql_connection_pool.h"
 
 using namespace std;
 
+thread_local connection_pool::thread_conn connection_pool::t_conn = {NULL, false,
+                                                                     0};
+
 connection_pool::connection_pool() {
+    this->MinConn = 0;
+    this->MaxConn = 0;
     this->CurConn = 0;
     this->FreeConn = 0;
+    this->Pending = 0;
+    this->IdleTimeout = 60;
+    this->PingInterval = 30;
+    this->AcquireTimeout = -1;
+    this->ThreadAffine = false;
+    this->Adopted = 0;
+    this->m_started = false;
+    this->m_stop = false;
+    this->Port = 0;
 }
 
 connection_pool *connection_pool::GetInstance() {
@@ -21,62 +39,221 @@ connection_pool *connection_pool::GetInstance() {
     return &connPool;
 }
 
+long long connection_pool::NowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// 等待时间和使用率的分布，各自落在一个区间
+static void record_wait(long long us) {
+    METRIC m = us < 100      ? DB_WAIT_100US
+               : us < 1000   ? DB_WAIT_1MS
+               : us < 10000  ? DB_WAIT_10MS
+               : us < 100000 ? DB_WAIT_100MS
+                             : DB_WAIT_SLOW;
+    metrics::get_instance()->add(m);
+}
+
+static void record_busy(unsigned int busy, unsigned int max) {
+    unsigned int quarter = (busy * 4 + max - 1) / max;
+    METRIC m = quarter <= 1 ? DB_BUSY_25
+               : quarter == 2 ? DB_BUSY_50
+               : quarter == 3 ? DB_BUSY_75
+                              : DB_BUSY_100;
+    metrics::get_instance()->add(m);
+}
+
 // 构造初始化，应只手动调用一次
 void connection_pool::init(string url, string User, string PassWord,
-                           string DBName, int Port, unsigned int MaxConn) {
+                           string DBName, int Port, unsigned int MinConn,
+                           unsigned int MaxConn, int IdleTimeout,
+                           int PingInterval) {
     this->url = url;
     this->Port = Port;
     this->User = User;
     this->PassWord = PassWord;
     this->DatabaseName = DBName;
+    this->MinConn = MinConn;
+    this->MaxConn = MaxConn > MinConn ? MaxConn : MinConn;
+    if (this->MaxConn == 0)
+        this->MaxConn = 1;
+    this->IdleTimeout = IdleTimeout > 0 ? IdleTimeout : 60;
+    this->PingInterval = PingInterval > 0 ? PingInterval : 30;
 
     lock.lock();
-    FreeConn = 0;
-    // 创建MaxConn条数据库连接
-    for (int i = 0; i < MaxConn; i++) {
-        MYSQL *con = NULL;
-        con = mysql_init(con); // 获取或初始化MYSQL结构。
+    // 创建MinConn条数据库连接，数据库暂时不可用时不退出，由后台线程继续补足
+    for (unsigned int i = 0; i < MinConn; i++) {
+        MYSQL *con = Connect();
+        if (con == NULL)
+            break;
+        idle_conn c = {con, NowUs()};
+        connList.push_back(c);
+        ++FreeConn;
+    }
+    lock.unlock();
 
-        if (con == NULL) {
-            cout << "Error:" << mysql_error(con);
-            exit(1);
-        }
-        // 数据库引擎建立连接
-        con =
-            mysql_real_connect(con, url.c_str(), User.c_str(), PassWord.c_str(),
-                               DBName.c_str(), Port, NULL, 0);
+    if (pthread_create(&m_keeper, NULL, keeper, this) != 0) {
+        LOG_ERROR("%s", "create mysql keeper thread failure");
+        Log::get_instance()->flush();
+        return;
+    }
+    m_started = true;
+}
 
-        if (con == NULL) {
-            cout << "Error: " << mysql_error(con);
-            exit(1);
-        }
-        connList.push_back(con);
-        ++FreeConn;
+MYSQL *connection_pool::Connect() {
+    // 初始化与预处理语句缓存一起分配的MYSQL结构，mysql_close不会释放它
+    pooled_conn *pc = new pooled_conn();
+    MYSQL *con = mysql_init(&pc->mysql);
+    if (con == NULL) {
+        LOG_ERROR("%s", "mysql_init failure");
+        Log::get_instance()->flush();
+        metrics::get_instance()->add(DB_CONN_FAIL);
+        delete pc;
+        return NULL;
     }
+    // 数据库主机不可达时不要让取连接的线程长时间阻塞
+    unsigned int timeout = 3;
+    mysql_options(con, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+    // 数据库停顿时查询超时返回错误，而不是一直占用工作线程
+    unsigned int io_timeout = 5;
+    mysql_options(con, MYSQL_OPT_READ_TIMEOUT, &io_timeout);
+    mysql_options(con, MYSQL_OPT_WRITE_TIMEOUT, &io_timeout);
 
-    reserve = sem(FreeConn);
-    this->MaxConn = FreeConn;
+    // 数据库引擎建立连接
+    if (mysql_real_connect(con, url.c_str(), User.c_str(), PassWord.c_str(),
+                           DatabaseName.c_str(), Port, NULL, 0) == NULL) {
+        LOG_ERROR("mysql connect failure: %s", mysql_error(con));
+        Log::get_instance()->flush();
+        mysql_close(con);
+        delete pc;
+        metrics::get_instance()->add(DB_CONN_FAIL);
+        return NULL;
+    }
+    metrics::get_instance()->add(DB_CONN_CREATE);
+    metrics::get_instance()->add(DB_CONN_OPEN);
+    return con;
+}
 
-    lock.unlock();
+void connection_pool::Close(MYSQL *con) {
+    pooled_conn *pc = (pooled_conn *)con;
+    for (int i = 0; i < MAX_STATEMENTS; ++i) {
+        if (pc->stmts[i])
+            mysql_stmt_close(pc->stmts[i]);
+    }
+    mysql_close(con);
+    delete pc;
+    metrics::get_instance()->add(DB_CONN_CLOSE);
+    metrics::get_instance()->add(DB_CONN_OPEN, -1);
 }
 
 // 当有请求时，从数据库连接池中返回一个可用连接，更新使用和空闲连接数
+// 没有空闲连接时，未达到MaxConn就新建一条，否则等待其他线程归还，最多等待AcquireTimeout
 MYSQL *connection_pool::GetConnection() {
-    if (0 == connList.size())
-        return NULL;
+    long long begin = NowUs();
     MYSQL *con = NULL;
+    long long idle = 0;
 
-    // 取出连接，信号量原子减1，为0则等待
-    reserve.wait();
+    // 本线程独占的连接，不加锁
+    if (t_conn.con && !t_conn.busy) {
+        con = t_conn.con;
+        if (begin - t_conn.since >= CHECK_IDLE_MS * 1000LL &&
+            mysql_ping(con) != 0) {
+            Close(con);
+            metrics::get_instance()->add(DB_CONN_RECONNECT);
+            con = Connect();
+            t_conn.con = con;
+            if (con == NULL) {
+                // 换不到新连接时放弃独占，名额还给共享池
+                lock.lock();
+                --CurConn;
+                --Adopted;
+                lock.unlock();
+                released.signal();
+                metrics::get_instance()->add(DB_CONN_AFFINE, -1);
+                return NULL;
+            }
+        }
+        t_conn.busy = true;
+        record_wait(NowUs() - begin);
+        metrics::get_instance()->add(DB_CONN_BUSY);
+        return con;
+    }
+    // 条件变量按CLOCK_REALTIME计时
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    if (AcquireTimeout >= 0) {
+        deadline.tv_sec += AcquireTimeout / 1000;
+        deadline.tv_nsec += (AcquireTimeout % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
 
     lock.lock();
-
-    con = connList.front();
-    connList.pop_front();
-    --FreeConn;
+    while (con == NULL) {
+        if (!connList.empty()) {
+            // 取最近归还的连接，空闲最久的留在开头等待关闭
+            idle = begin - connList.back().since;
+            con = connList.back().con;
+            connList.pop_back();
+            --FreeConn;
+        } else if (FreeConn + CurConn + Pending < MaxConn) {
+            ++Pending;
+            lock.unlock();
+            con = Connect();
+            lock.lock();
+            --Pending;
+            if (con == NULL) {
+                // 让出名额，其他等待的线程可以再尝试
+                released.signal();
+                lock.unlock();
+                return NULL;
+            }
+        } else if (AcquireTimeout < 0) {
+            released.wait(lock.get());
+        } else if (NowUs() - begin >= AcquireTimeout * 1000LL) {
+            lock.unlock();
+            metrics::get_instance()->add(DB_ACQUIRE_TIMEOUT);
+            return NULL;
+        } else {
+            released.timewait(lock.get(), deadline);
+        }
+    }
     ++CurConn;
-
+    unsigned int busy = CurConn;
+    // 线程独占模式下，还没有独占连接的线程留下这条连接；
+    // 至少留一条在共享池中，没能独占的线程还能轮流使用
+    bool adopt = ThreadAffine && t_conn.con == NULL && !t_conn.busy &&
+                 Adopted + 1 < MaxConn;
+    if (adopt)
+        ++Adopted;
     lock.unlock();
+
+    // 空闲较久的连接可能已被数据库断开（如数据库重启），检查后换成新连接
+    if (idle >= CHECK_IDLE_MS * 1000LL && mysql_ping(con) != 0) {
+        Close(con);
+        metrics::get_instance()->add(DB_CONN_RECONNECT);
+        con = Connect();
+        if (con == NULL) {
+            lock.lock();
+            --CurConn;
+            if (adopt)
+                --Adopted;
+            lock.unlock();
+            released.signal();
+            return NULL;
+        }
+    }
+    if (adopt) {
+        t_conn.con = con;
+        t_conn.busy = true;
+        metrics::get_instance()->add(DB_CONN_AFFINE);
+    }
+    record_wait(NowUs() - begin);
+    record_busy(busy, MaxConn);
+    metrics::get_instance()->add(DB_CONN_BUSY);
     return con;
 }
 
@@ -84,37 +261,196 @@ MYSQL *connection_pool::GetConnection() {
 bool connection_pool::ReleaseConnection(MYSQL *con) {
     if (NULL == con)
         return false;
+    metrics::get_instance()->add(DB_CONN_BUSY, -1);
 
-    lock.lock();
+    // 使用中发现已断开的连接不再放回，下次需要时新建
+    unsigned int err = mysql_errno(con);
+    bool broken = err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST;
+    if (broken) {
+        Close(con);
+        metrics::get_instance()->add(DB_CONN_RECONNECT);
+    }
 
-    connList.push_back(con);
-    ++FreeConn;
-    --CurConn;
+    // 本线程独占的连接留在线程中，断开时放弃独占，下次从共享池中换一条
+    if (con == t_conn.con) {
+        t_conn.busy = false;
+        t_conn.since = NowUs();
+        if (!broken)
+            return true;
+        t_conn.con = NULL;
+        metrics::get_instance()->add(DB_CONN_AFFINE, -1);
+        lock.lock();
+        --CurConn;
+        --Adopted;
+        lock.unlock();
+        released.signal();
+        return true;
+    }
 
+    lock.lock();
+    --CurConn;
+    if (!broken) {
+        idle_conn c = {con, NowUs()};
+        connList.push_back(c);
+        ++FreeConn;
+    }
     lock.unlock();
 
-    reserve.post();
+    released.signal();
     return true;
 }
 
-// 销毁数据库连接池
-void connection_pool::DestroyPool() {
+// 连接同一时刻只被一个线程使用，缓存不需要加锁
+MYSQL_STMT *connection_pool::Prepare(MYSQL *con, int id, const char *sql) {
+    if (id < 0 || id >= MAX_STATEMENTS)
+        return NULL;
+    pooled_conn *pc = (pooled_conn *)con;
+    if (pc->stmts[id])
+        return pc->stmts[id];
+    MYSQL_STMT *stmt = mysql_stmt_init(con);
+    if (stmt == NULL)
+        return NULL;
+    if (mysql_stmt_prepare(stmt, sql, strlen(sql))) {
+        LOG_ERROR("mysql prepare failure: %s", mysql_stmt_error(stmt));
+        Log::get_instance()->flush();
+        mysql_stmt_close(stmt);
+        return NULL;
+    }
+    metrics::get_instance()->add(DB_STMT_PREPARE);
+    pc->stmts[id] = stmt;
+    return stmt;
+}
 
+void connection_pool::ReleaseThread() {
+    MYSQL *con = t_conn.con;
+    if (con == NULL || t_conn.busy)
+        return;
+    t_conn.con = NULL;
+    metrics::get_instance()->add(DB_CONN_AFFINE, -1);
     lock.lock();
-    if (connList.size() > 0) {
-        list<MYSQL *>::iterator it;
-        for (it = connList.begin(); it != connList.end(); ++it) {
-            MYSQL *con = *it;
-            // 关闭数据库连接
-            mysql_close(con);
-        }
-        CurConn = 0;
-        FreeConn = 0;
-        connList.clear();
+    --CurConn;
+    --Adopted;
+    idle_conn c = {con, t_conn.since};
+    connList.push_back(c);
+    ++FreeConn;
+    lock.unlock();
+    released.signal();
+}
+
+connection_pool::thread_conn::~thread_conn() {
+    if (con)
+        connection_pool::GetInstance()->ReleaseThread();
+}
+
+void *connection_pool::keeper(void *arg) {
+    connection_pool *pool = (connection_pool *)arg;
+    pool->Keep();
+    return pool;
+}
 
+// 后台线程每PingInterval秒维护一次空闲连接，ping和建立连接时不持有锁
+void connection_pool::Keep() {
+    lock.lock();
+    while (!m_stop) {
+        struct timespec t;
+        clock_gettime(CLOCK_REALTIME, &t);
+        t.tv_sec += PingInterval;
+        stopping.timewait(lock.get(), t);
+        if (m_stop)
+            break;
+
+        long long now = NowUs();
+        // 多出MinConn的连接从空闲最久的开始关闭
+        list<MYSQL *> expired;
+        while (!connList.empty() && FreeConn + CurConn + Pending > MinConn &&
+               now - connList.front().since >= IdleTimeout * 1000000LL) {
+            expired.push_back(connList.front().con);
+            connList.pop_front();
+            --FreeConn;
+        }
+        // 其余空闲超过PingInterval的连接取出来检查，检查期间计入Pending
+        list<idle_conn> checking;
+        for (list<idle_conn>::iterator it = connList.begin();
+             it != connList.end();) {
+            if (now - it->since >= PingInterval * 1000000LL) {
+                checking.push_back(*it);
+                it = connList.erase(it);
+                --FreeConn;
+                ++Pending;
+            } else {
+                ++it;
+            }
+        }
+        // 连接数不足MinConn时补足
+        unsigned int total = FreeConn + CurConn + Pending;
+        unsigned int missing = total < MinConn ? MinConn - total : 0;
+        Pending += missing;
         lock.unlock();
+
+        for (list<MYSQL *>::iterator it = expired.begin(); it != expired.end();
+             ++it)
+            Close(*it);
+        list<idle_conn> alive;
+        for (list<idle_conn>::iterator it = checking.begin();
+             it != checking.end(); ++it) {
+            if (mysql_ping(it->con) == 0) {
+                alive.push_back(*it);
+                continue;
+            }
+            Close(it->con);
+            metrics::get_instance()->add(DB_CONN_RECONNECT);
+            MYSQL *con = Connect();
+            if (con) {
+                idle_conn c = {con, NowUs()};
+                alive.push_back(c);
+            }
+        }
+        list<idle_conn> created;
+        for (unsigned int i = 0; i < missing; ++i) {
+            MYSQL *con = Connect();
+            if (con == NULL)
+                break;
+            idle_conn c = {con, NowUs()};
+            created.push_back(c);
+        }
+        if (!expired.empty() || !checking.empty() || !created.empty()) {
+            LOG_INFO("mysql pool keep: closed %d, checked %d, created %d",
+                     (int)expired.size(), (int)checking.size(),
+                     (int)created.size());
+            Log::get_instance()->flush();
+        }
+
+        lock.lock();
+        Pending -= checking.size() + missing;
+        FreeConn += alive.size() + created.size();
+        // 检查过的连接仍按原来的空闲时间排在开头，新建的排在末尾
+        connList.splice(connList.begin(), alive);
+        connList.splice(connList.end(), created);
+        released.broadcast();
     }
+    lock.unlock();
+}
 
+// 销毁数据库连接池
+void connection_pool::DestroyPool() {
+    lock.lock();
+    m_stop = true;
+    stopping.signal();
+    lock.unlock();
+    if (m_started) {
+        pthread_join(m_keeper, NULL);
+        m_started = false;
+    }
+
+    lock.lock();
+    list<idle_conn>::iterator it;
+    for (it = connList.begin(); it != connList.end(); ++it) {
+        // 关闭数据库连接
+        Close(it->con);
+    }
+    CurConn = 0;
+    FreeConn = 0;
+    connList.clear();
     lock.unlock();
 }
 
@@ -134,4 +470,4 @@ connectionRAII::connectionRAII(MYSQL **SQL, connection_pool *connPool) {
 connectionRAII::~connectionRAII() {
     // 析构调用数据库连接回收函数
     poolRAII->ReleaseConnection(conRAII);
-}
\ No newline at end of file
+}
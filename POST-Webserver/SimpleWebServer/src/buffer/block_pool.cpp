@@ -0,0 +1,83 @@
+#include "block_pool.h"
+#include "metrics.h"
+#include "placement.h"
+
+block_pool::block_pool() : m_max_free_bytes(16 << 20), m_used_bytes(0) {
+    for (int n = 0; n < MAX_NODES; ++n) {
+        for (int i = 0; i < CLASS_NUMBER; ++i) {
+            m_free[n][i].head = NULL;
+            m_free[n][i].count = 0;
+        }
+    }
+}
+
+block_pool::~block_pool() {
+    for (int n = 0; n < MAX_NODES; ++n) {
+        for (int i = 0; i < CLASS_NUMBER; ++i) {
+            while (m_free[n][i].head) {
+                free_block *block = m_free[n][i].head;
+                m_free[n][i].head = block->next;
+                delete[](char *) block;
+            }
+        }
+    }
+}
+
+// 当前线程所在节点的空闲链表，没有绑定CPU的线程都使用0号节点的链表
+block_pool::free_list &block_pool::local_list(int idx) {
+    return m_free[placement::current_node() % MAX_NODES][idx];
+}
+
+void block_pool::init(size_t max_free_bytes) { m_max_free_bytes = max_free_bytes; }
+
+// 不小于size的最小块所在的下标
+int block_pool::size_class(size_t size) {
+    int idx = 0;
+    while ((MIN_BLOCK_SIZE << idx) < size)
+        ++idx;
+    return idx;
+}
+
+char *block_pool::acquire(size_t size) {
+    if (size > MAX_BLOCK_SIZE)
+        return NULL;
+    int idx = size_class(size);
+    size_t block_size = MIN_BLOCK_SIZE << idx;
+    m_used_bytes += block_size;
+
+    free_list &list = local_list(idx);
+    list.lock.lock();
+    free_block *block = list.head;
+    if (block) {
+        list.head = block->next;
+        --list.count;
+    }
+    list.lock.unlock();
+    if (block)
+        return (char *)block;
+    metrics::get_instance()->add(ALLOC_BLOCK);
+    return new char[block_size];
+}
+
+void block_pool::release(char *block, size_t size) {
+    if (!block)
+        return;
+    int idx = size_class(size);
+    size_t block_size = MIN_BLOCK_SIZE << idx;
+    m_used_bytes -= block_size;
+
+    free_list &list = local_list(idx);
+    list.lock.lock();
+    if ((list.count + 1) * block_size <= m_max_free_bytes) {
+        free_block *node = (free_block *)block;
+        node->next = list.head;
+        list.head = node;
+        ++list.count;
+        block = NULL;
+    }
+    list.lock.unlock();
+    if (block) {
+        metrics::get_instance()->add(FREE_BLOCK);
+        delete[] block;
+    }
+}
@@ -0,0 +1,83 @@
+#include <stdio.h>
+
+#include "chain_buffer.h"
+
+bool chain_buffer::append(const char *format, va_list args) {
+    // 先尝试写入尾块，放不下时换一个新块再写一次
+    for (int retry = 0; retry < 2; ++retry) {
+        if (m_count == 0 || retry == 1) {
+            if (m_count == MAX_BLOCKS)
+                return false;
+            m_blocks[m_count] =
+                block_pool::get_instance()->acquire(block_pool::MIN_BLOCK_SIZE);
+            m_lens[m_count++] = 0;
+        }
+        size_t used = m_lens[m_count - 1];
+        size_t room = block_pool::MIN_BLOCK_SIZE - used;
+        va_list ap;
+        va_copy(ap, args);
+        int len = vsnprintf(m_blocks[m_count - 1] + used, room, format, ap);
+        va_end(ap);
+        if (len < 0)
+            return false;
+        if ((size_t)len < room) {
+            m_last = m_blocks[m_count - 1] + used;
+            m_lens[m_count - 1] += len;
+            m_size += len;
+            return true;
+        }
+        // 一个空块也放不下
+        if (used == 0)
+            return false;
+    }
+    return false;
+}
+
+int chain_buffer::take_iov(struct iovec *iv, int max) {
+    int n = 0;
+    size_t start = 0;
+    for (int i = 0; i < m_count; ++i) {
+        size_t end = start + m_lens[i];
+        if (end > m_mark) {
+            if (n == max)
+                return -1;
+            size_t skip = m_mark > start ? m_mark - start : 0;
+            iv[n].iov_base = m_blocks[i] + skip;
+            iv[n].iov_len = m_lens[i] - skip;
+            ++n;
+        }
+        start = end;
+    }
+    m_mark = m_size;
+    return n;
+}
+
+void chain_buffer::truncate(size_t pos) {
+    size_t start = 0;
+    int keep = 0;
+    // 保留包含pos之前内容的块
+    while (keep < m_count && start + m_lens[keep] < pos)
+        start += m_lens[keep++];
+    if (keep < m_count) {
+        m_lens[keep] = pos - start;
+        ++keep;
+    }
+    for (int i = keep; i < m_count; ++i)
+        block_pool::get_instance()->release(m_blocks[i],
+                                            block_pool::MIN_BLOCK_SIZE);
+    m_count = keep;
+    m_size = pos;
+    if (m_mark > pos)
+        m_mark = pos;
+    m_last = "";
+}
+
+void chain_buffer::clear() {
+    for (int i = 0; i < m_count; ++i)
+        block_pool::get_instance()->release(m_blocks[i],
+                                            block_pool::MIN_BLOCK_SIZE);
+    m_count = 0;
+    m_size = 0;
+    m_mark = 0;
+    m_last = "";
+}
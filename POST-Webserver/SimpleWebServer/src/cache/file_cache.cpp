@@ -0,0 +1,161 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "file_cache.h"
+#include "log.h"
+
+file_cache::file_cache()
+    : m_max_bytes(0), m_max_file_size(0), m_check_interval(1),
+      m_cur_bytes(0) {}
+
+file_cache::~file_cache() {
+    m_lock.lock();
+    while (!m_lru.empty())
+        drop(m_lru.back());
+    m_lock.unlock();
+}
+
+void file_cache::init(size_t max_bytes, size_t max_file_size,
+                      int check_interval) {
+    m_lock.lock();
+    m_max_bytes = max_bytes;
+    m_max_file_size = max_file_size < max_bytes ? max_file_size : max_bytes;
+    m_check_interval = check_interval;
+    evict();
+    m_lock.unlock();
+}
+
+// 同一个文件且未被修改
+static bool same_file(const struct stat &a, const struct stat &b) {
+    return a.st_ino == b.st_ino && a.st_size == b.st_size &&
+           a.st_mtim.tv_sec == b.st_mtim.tv_sec &&
+           a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+}
+
+file_entry *file_cache::acquire(const char *path, struct stat *st,
+                                bool *stated) {
+    *stated = false;
+    if (m_max_bytes == 0)
+        return NULL;
+    time_t now = time(NULL);
+    // 本次调用是否已经stat过path，结果在st中，stat失败时st_mode为0
+    bool have_stat = false;
+
+    m_lock.lock();
+    std::unordered_map<std::string, file_entry *>::iterator it =
+        m_entries.find(path);
+    if (it != m_entries.end()) {
+        file_entry *entry = it->second;
+        ++entry->ref;
+        m_lru.splice(m_lru.begin(), m_lru, entry->lru);
+        // 检查间隔内直接命中，不需要任何系统调用
+        if (now - entry->checked < m_check_interval) {
+            m_lock.unlock();
+            return entry;
+        }
+        m_lock.unlock();
+
+        have_stat = true;
+        if (stat(path, st) < 0)
+            st->st_mode = 0;
+        else if (same_file(*st, entry->st)) {
+            m_lock.lock();
+            entry->checked = now;
+            m_lock.unlock();
+            return entry;
+        }
+
+        // 文件被修改或删除，移出缓存，正在发送的响应不受影响
+        LOG_INFO("file cache invalidate %s", path);
+        m_lock.lock();
+        if (entry->cached)
+            drop(entry);
+        m_lock.unlock();
+        release(entry);
+    } else {
+        m_lock.unlock();
+    }
+
+    // 文件被修改时重新加载，用上面检查时的结果，不再stat
+    if (!have_stat && stat(path, st) < 0)
+        st->st_mode = 0;
+    // 不缓存的文件由调用者直接使用这次stat的结果，同一个请求只stat一次
+    *stated = true;
+    if (!S_ISREG(st->st_mode) || !(st->st_mode & S_IROTH) ||
+        (size_t)st->st_size > m_max_file_size)
+        return NULL;
+    file_entry *entry = load(path, *st);
+    if (!entry)
+        return NULL;
+    entry->checked = now;
+
+    m_lock.lock();
+    it = m_entries.find(path);
+    if (it != m_entries.end()) {
+        // 其他线程已经加载了同一个文件
+        file_entry *loaded = it->second;
+        ++loaded->ref;
+        m_lock.unlock();
+        release(entry);
+        return loaded;
+    }
+    ++entry->ref;
+    entry->cached = true;
+    m_entries[entry->path] = entry;
+    m_lru.push_front(entry);
+    entry->lru = m_lru.begin();
+    m_cur_bytes += entry->st.st_size;
+    evict();
+    m_lock.unlock();
+    return entry;
+}
+
+void file_cache::release(file_entry *entry) {
+    if (--entry->ref == 0) {
+        delete[] entry->data;
+        delete entry;
+    }
+}
+
+// 把文件读入内存，返回的entry只有调用者的一个引用
+file_entry *file_cache::load(const char *path, const struct stat &st) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    char *data = st.st_size > 0 ? new char[st.st_size] : NULL;
+    off_t have_read = 0;
+    while (have_read < st.st_size) {
+        ssize_t n = read(fd, data + have_read, st.st_size - have_read);
+        if (n <= 0) {
+            // 读取过程中文件被截断
+            close(fd);
+            delete[] data;
+            return NULL;
+        }
+        have_read += n;
+    }
+    close(fd);
+
+    file_entry *entry = new file_entry;
+    entry->path = path;
+    entry->data = data;
+    entry->st = st;
+    entry->ref = 1;
+    entry->cached = false;
+    return entry;
+}
+
+// 从缓存中移除并释放缓存持有的引用，需持有m_lock
+void file_cache::drop(file_entry *entry) {
+    m_entries.erase(entry->path);
+    m_lru.erase(entry->lru);
+    m_cur_bytes -= entry->st.st_size;
+    entry->cached = false;
+    release(entry);
+}
+
+// 按LRU淘汰直到不超过容量，需持有m_lock
+void file_cache::evict() {
+    while (m_cur_bytes > m_max_bytes && !m_lru.empty())
+        drop(m_lru.back());
+}
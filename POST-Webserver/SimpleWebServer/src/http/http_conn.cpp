@@ -1,7 +1,10 @@
 #include "http_conn.h"
+#include "http_scan.h"
 #include "log.h"
+#include "metrics.h"
 #include <fstream>
 #include <map>
+#include <set>
 #include <mysql/mysql.h>
 
 // 默认都采用epoll的ET模式
@@ -17,22 +20,40 @@ const char *error_403_form =
 const char *error_404_title = "Not Found";
 const char *error_404_form =
     "The requested file was not found on this server.\n";
+const char *partial_206_title = "Partial Content";
+const char *error_416_title = "Range Not Satisfiable";
+const char *error_416_form =
+    "The requested range is not satisfiable for this resource.\n";
 const char *error_500_title = "Internal Error";
 const char *error_500_form =
     "There was an unusual problem serving the request file.\n";
+const char *error_503_title = "Service Unavailable";
+const char *error_503_form =
+    "The server is overloaded, please retry later.\n";
+
+// multipart/byteranges响应的分隔符
+const char *range_boundary = "SimpleWebServerByteRanges";
 
 // 网站的根目录
 const char *doc_root = "/home/ubuntu/SimpleWebServer/root";
 
 // 将表中的用户名和密码放入map
 map<string, string> users;
-// 写SQL的互斥锁
+
+// 正在写入数据库的用户名，写入期间同名的注册直接失败
+set<string> pending_users;
+// 保护users和pending_users的互斥锁，写入数据库时不持有
 locker m_lock;
 
 void http_conn::initmysql_result(connection_pool *connPool) {
     // 先从连接池中取一个连接
     MYSQL *mysql = NULL;
     connectionRAII mysqlcon(&mysql, connPool);
+    if (mysql == NULL) {
+        LOG_ERROR("%s", "load users failure: no mysql connection");
+        Log::get_instance()->flush();
+        return;
+    }
 
     // 在user表中检索username，passwd数据，浏览器端输入
     if (mysql_query(mysql, "SELECT username,passwd FROM user")) {
@@ -67,9 +88,10 @@ int setnonblocking(int fd) {
 }
 
 // 将内核事件表注册读事件，ET模式，选择开启EPOLLONESHOT
-void addfd(int epollfd, int fd, bool one_shot) {
+// data.ptr为注册时传入的指针（连接对象），事件到来时不再需要按fd查表
+void addfd(int epollfd, int fd, bool one_shot, void *ptr) {
     epoll_event event;
-    event.data.fd = fd;
+    event.data.ptr = ptr;
     event.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
     if (one_shot)
         event.events |= EPOLLONESHOT;
@@ -84,20 +106,26 @@ void removefd(int epollfd, int fd) {
 }
 
 // 重新添加描述符
-void modfd(int epollfd, int fd, int ev) {
+void modfd(int epollfd, int fd, int ev, void *ptr) {
     epoll_event event;
-    event.data.fd = fd;
+    event.data.ptr = ptr;
     // 始终维持一个socket连接在任一时刻都只被一个线程处理
     event.events = ev | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
 }
 
-int http_conn::m_user_count = 0;
-int http_conn::m_epollfd = -1;
+std::atomic<int> http_conn::m_user_count(0);
+off_t http_conn::m_sendfile_threshold = 1 << 20;
+batch_writer *http_conn::m_writer = NULL;
+breaker http_conn::m_db_breaker;
 
 // 关闭连接，关闭一个连接，客户总量减一
 void http_conn::close_conn(bool real_close) {
     if (real_close && (m_sockfd != -1)) {
+        // 响应未发送完就关闭时，归还文件映射或缓存引用
+        release_files();
+        m_write_buf.clear();
+        release_read_buf();
         removefd(m_epollfd, m_sockfd);
         m_sockfd = -1;
         m_user_count--;
@@ -105,21 +133,31 @@ void http_conn::close_conn(bool real_close) {
 }
 
 // 初始化连接,外部调用初始化套接字地址
-void http_conn::init(int sockfd, const sockaddr_in &addr) {
+void http_conn::init(int sockfd, const sockaddr_in &addr, int epollfd) {
+    m_epollfd = epollfd;
     m_sockfd = sockfd;
     m_address = addr;
-    addfd(m_epollfd, sockfd, true);
+    addfd(m_epollfd, sockfd, true, this);
     m_user_count++;
+    closing = false;
     init();
 }
 
 // 初始化新接受的连接
-// check_state默认为分析请求行状态
 void http_conn::init() {
-    mysql = NULL;
-    bytes_to_send = 0;
-    bytes_have_send = 0;
+    lane = LANE_STATIC;
+    m_start_line = 0;
+    m_checked_idx = 0;
+    m_read_idx = 0;
+    reset_request();
+    reset_response();
+}
+
+// 一个请求解析完后重置解析状态，读缓冲区中剩下的字节属于下一个请求
+// check_state默认为分析请求行状态
+void http_conn::reset_request() {
     cgi = 0;
+    m_string = 0;
 
     // 设置主状态机起始状态为 请求行
     m_check_state = CHECK_STATE_REQUESTLINE;
@@ -129,56 +167,170 @@ void http_conn::init() {
     m_url = 0;
     m_version = 0;
     m_content_length = 0;
+    m_db_admitted = false;
     m_host = 0;
+    m_range = 0;
+    m_if_range = 0;
+    m_range_count = 0;
+    memset(m_real_file, '\0', FILENAME_LEN);
+}
+
+// 排队的响应全部发送完后清空写缓冲区
+void http_conn::reset_response() {
+    bytes_to_send = 0;
+    bytes_have_send = 0;
+    m_write_buf.clear();
+    m_iv_count = 0;
+    m_iv_idx = 0;
+    m_resp_count = 0;
+    m_resp_linger = false;
+}
+
+// 把未解析完的请求移到读缓冲区开头，为后续数据腾出空间
+void http_conn::compact_read_buf() {
+    if (m_check_state != CHECK_STATE_REQUESTLINE || m_start_line == 0)
+        return;
+    memmove(m_read_buf, m_read_buf + m_start_line, m_read_idx - m_start_line);
+    m_checked_idx -= m_start_line;
+    m_read_idx -= m_start_line;
     m_start_line = 0;
-    m_checked_idx = 0;
-    m_read_idx = 0;
-    m_write_idx = 0;
+}
 
-    memset(m_read_buf, '\0', READ_BUFFER_SIZE);
-    memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
-    memset(m_real_file, '\0', FILENAME_LEN);
+// 读缓冲区放满时换一个两倍大的块，已解析出的字段指向旧块，需要一起平移
+bool http_conn::grow_read_buf() {
+    if (m_read_size >= MAX_READ_BUFFER_SIZE)
+        return false;
+    int size = m_read_size ? m_read_size * 2 : READ_BUFFER_SIZE;
+    char *buf = block_pool::get_instance()->acquire(size);
+    if (m_read_buf) {
+        memcpy(buf, m_read_buf, m_read_idx);
+        char **fields[] = {&m_url, &m_version, &m_host, &m_range, &m_if_range};
+        for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); ++i)
+            if (*fields[i])
+                *fields[i] = buf + (*fields[i] - m_read_buf);
+        block_pool::get_instance()->release(m_read_buf, m_read_size);
+    }
+    m_read_buf = buf;
+    m_read_size = size;
+    return true;
+}
+
+void http_conn::release_read_buf() {
+    block_pool::get_instance()->release(m_read_buf, m_read_size);
+    m_read_buf = NULL;
+    m_read_size = 0;
 }
 
 // 从状态机，用于读取http报文一行的内容
 // 返回值为行的读取状态，有LINE_OK,LINE_BAD,LINE_OPEN
 http_conn::LINE_STATUS http_conn::parse_line() {
-    char temp;
-    for (; m_checked_idx < m_read_idx; ++m_checked_idx) {
-        temp = m_read_buf[m_checked_idx];
-        if (temp == '\r') {
-            if ((m_checked_idx + 1) == m_read_idx)
-                return LINE_OPEN;
-            else if (m_read_buf[m_checked_idx + 1] == '\n') {
-                // 显式结尾
-                m_read_buf[m_checked_idx++] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
-        } else if (temp == '\n') {
-            if (m_checked_idx > 1 && m_read_buf[m_checked_idx - 1] == '\r') {
-                m_read_buf[m_checked_idx - 1] = '\0';
-                m_read_buf[m_checked_idx++] = '\0';
-                return LINE_OK;
-            }
-            return LINE_BAD;
+    // 向量化地跳过普通字符，直接定位到下一个'\r'或'\n'
+    m_checked_idx = scan_line_end(m_read_buf + m_checked_idx,
+                                  m_read_buf + m_read_idx) -
+                    m_read_buf;
+    if (m_checked_idx == m_read_idx)
+        return LINE_OPEN;
+    if (m_read_buf[m_checked_idx] == '\r') {
+        if ((m_checked_idx + 1) == m_read_idx)
+            return LINE_OPEN;
+        else if (m_read_buf[m_checked_idx + 1] == '\n') {
+            // 显式结尾
+            m_read_buf[m_checked_idx++] = '\0';
+            m_read_buf[m_checked_idx++] = '\0';
+            return LINE_OK;
         }
+        return LINE_BAD;
     }
-    return LINE_OPEN;
+    if (m_checked_idx > 1 && m_read_buf[m_checked_idx - 1] == '\r') {
+        m_read_buf[m_checked_idx - 1] = '\0';
+        m_read_buf[m_checked_idx++] = '\0';
+        return LINE_OK;
+    }
+    return LINE_BAD;
 }
 
 // 循环读取客户数据，直到无数据可读或对方关闭连接
 // 因为在ET工作模式下，需要一次性将数据读完
+// 缓冲区最后留一个字节，截断请求体时不会越界
+// 响应没有发完时为发送阶段；请求体没有读完时为读请求体阶段；
+// 读缓冲区中有未处理完的数据时说明下一个请求已经开始
+http_conn::TIMEOUT_PHASE http_conn::timeout_phase() {
+    if (bytes_to_send > 0)
+        return PHASE_WRITE;
+    if (m_check_state == CHECK_STATE_CONTENT)
+        return PHASE_BODY;
+    if (m_read_idx > 0)
+        return PHASE_HEADER;
+    return PHASE_IDLE;
+}
+
+// 请求行已经解析过时按方法判断；否则看缓冲区中下一个请求的方法，
+// 请求行还不完整时先按静态请求处理，解析不出完整请求时不会用到数据库
+http_conn::LANE http_conn::next_lane() {
+    if (m_check_state != CHECK_STATE_REQUESTLINE)
+        return m_method == POST ? LANE_DB : LANE_STATIC;
+    if (m_read_idx - m_start_line >= 4 &&
+        strncasecmp(m_read_buf + m_start_line, "POST", 4) == 0)
+        return LANE_DB;
+    return LANE_STATIC;
+}
+
+http_conn::LANE http_conn::route() {
+    lane = next_lane();
+    return lane;
+}
+
+// 注册请求POST到最后一段以'3'开头的URL，与do_request的判断一致
+// 请求行还不完整时按不是注册处理，由do_request再检查熔断器
+bool http_conn::next_is_register() {
+    const char *url, *end;
+    if (m_check_state != CHECK_STATE_REQUESTLINE) {
+        if (m_method != POST || !m_url)
+            return false;
+        url = m_url;
+        end = m_url + strlen(m_url);
+    } else {
+        if (next_lane() != LANE_DB)
+            return false;
+        const char *line = m_read_buf + m_start_line;
+        const char *line_end = scan_line_end(line, m_read_buf + m_read_idx);
+        if (line_end == m_read_buf + m_read_idx)
+            return false;
+        url = line + 4;
+        url += strspn(url, " \t");
+        end = scan_space(url, line_end);
+    }
+    const char *slash = NULL;
+    for (const char *p = url; p < end; ++p)
+        if (*p == '/')
+            slash = p;
+    return slash && slash + 1 < end && slash[1] == '3';
+}
+
+// 熔断器在反应堆中检查，排队等待工作线程之前就拒绝
+// 通过检查的注册记下来，do_request中不再调用allow()，试探请求不会被消耗两次
+bool http_conn::db_admit() {
+    if (m_db_admitted || !next_is_register())
+        return true;
+    if (!m_db_breaker.allow()) {
+        metrics::get_instance()->add(DB_BREAKER_REJECT);
+        return false;
+    }
+    m_db_admitted = true;
+    return true;
+}
+
 bool http_conn::read_once() {
-    if (m_read_idx >= READ_BUFFER_SIZE) {
+    // 有数据到达时才取缓冲区，已经是最大的缓冲区且放满时说明请求过大
+    if (m_read_idx >= m_read_size - 1 && !grow_read_buf()) {
         return false;
     }
 
     int bytes_read = 0;
-    while (true) {
+    while (m_read_idx < m_read_size - 1 || grow_read_buf()) {
+        // 缓冲区不能再增大时先处理已读到的请求，剩下的数据在重新注册读事件后再读
         bytes_read = recv(m_sockfd, m_read_buf + m_read_idx,
-                          READ_BUFFER_SIZE - m_read_idx, 0);
+                          m_read_size - 1 - m_read_idx, 0);
         if (bytes_read == -1) {
             if (errno == EAGAIN || errno == EWOULDBLOCK)
                 break;
@@ -192,9 +344,11 @@ bool http_conn::read_once() {
 }
 
 // 解析HTTP请求行，获得请求方法、目标URL，以及HTTP版本号
+// 行已经以'\0'结尾，m_checked_idx为下一行的起始位置
 http_conn::HTTP_CODE http_conn::parse_request_line(char *text) {
-    m_url = strpbrk(text, " \t");
-    if (!m_url) {
+    char *end = m_read_buf + m_checked_idx;
+    m_url = (char *)scan_space(text, end);
+    if (*m_url == '\0') {
         return BAD_REQUEST;
     }
     *m_url++ = '\0';
@@ -210,8 +364,8 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text) {
     }
 
     m_url += strspn(m_url, " \t");
-    m_version = strpbrk(m_url, " \t");
-    if (!m_version) {
+    m_version = (char *)scan_space(m_url, end);
+    if (*m_version == '\0') {
         return BAD_REQUEST;
     }
 
@@ -256,20 +410,38 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text) {
             return NO_REQUEST;
         }
         return GET_REQUEST;
-    } else if (strncasecmp(text, "Connection:", 11) == 0) {
-        text += 11;
-        text += strspn(text, " \t");
-        if (strcasecmp(text, "keep-alive") == 0) {
+    }
+
+    // 先定位头部名结尾的':'，再按名字长度只做一次比较
+    char *colon = (char *)scan_colon(text, m_read_buf + m_checked_idx);
+    int name_len = colon - text;
+    char *value = colon + 1;
+    if (*colon == ':')
+        value += strspn(value, " \t");
+    else
+        name_len = 0;
+
+    if (name_len == 10 && strncasecmp(text, "Connection", 10) == 0) {
+        if (strcasecmp(value, "keep-alive") == 0) {
             m_linger = true;
         }
-    } else if (strncasecmp(text, "Content-length:", 15) == 0) {
-        text += 15;
-        text += strspn(text, " \t");
-        m_content_length = atoi(text);
-    } else if (strncasecmp(text, "Host:", 5) == 0) {
-        text += 5;
-        text += strspn(text, " \t");
-        m_host = text;
+    } else if (name_len == 14 && strncasecmp(text, "Content-length", 14) == 0) {
+        // 只接受十进制非负整数，且请求体必须能放进读缓冲区
+        char *end;
+        errno = 0;
+        long len = strtol(value, &end, 10);
+        end += strspn(end, " \t");
+        if (end == value || *end != '\0' || errno == ERANGE || len < 0 ||
+            len >= MAX_READ_BUFFER_SIZE)
+            return BAD_REQUEST;
+        m_content_length = len;
+    } else if (name_len == 4 && strncasecmp(text, "Host", 4) == 0) {
+        m_host = value;
+    } else if (name_len == 5 && strncasecmp(text, "Range", 5) == 0) {
+        // 只记录位置，文件大小确定后在do_request中解析
+        m_range = value;
+    } else if (name_len == 8 && strncasecmp(text, "If-Range", 8) == 0) {
+        m_if_range = value;
     } else {
         // 输出到日志
         LOG_INFO("oop! unknow header: %s", text);
@@ -281,6 +453,10 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text) {
 // 存储请求体
 http_conn::HTTP_CODE http_conn::parse_content(char *text) {
     if (m_read_idx >= (m_content_length + m_checked_idx)) {
+        // 请求体后面可能紧跟着下一个请求，截断前先保存，do_request之后恢复
+        m_checked_idx += m_content_length;
+        m_start_line = m_checked_idx;
+        m_body_end_char = m_read_buf[m_checked_idx];
         text[m_content_length] = '\0';
         // POST请求中最后为输入的用户名和密码
         m_string = text;
@@ -299,15 +475,19 @@ http_conn::HTTP_CODE http_conn::process_read() {
         两种可能:
         1.请求体，且之前无错误
         2.还在请求行、请求头，这时候需要读取一行
+        请求体不完整时不能再按行扫描，否则m_checked_idx会越过请求体的起始位置
     */
     while ((m_check_state == CHECK_STATE_CONTENT && line_status == LINE_OK) ||
-           ((line_status = parse_line()) == LINE_OK)) {
+           (m_check_state != CHECK_STATE_CONTENT &&
+            (line_status = parse_line()) == LINE_OK)) {
         text = get_line();
         // 修改下一行的起始位置
         m_start_line = m_checked_idx;
-        // 日志记录得到的信息
-        LOG_INFO("%s", text);
-        Log::get_instance()->flush();
+        // 日志记录得到的信息，请求体在parse_content截断之前没有结尾的'\0'
+        if (m_check_state != CHECK_STATE_CONTENT) {
+            LOG_INFO("%s", text);
+            Log::get_instance()->flush();
+        }
         switch (m_check_state) {
         case CHECK_STATE_REQUESTLINE: {
             ret = parse_request_line(text);
@@ -326,8 +506,11 @@ http_conn::HTTP_CODE http_conn::process_read() {
         }
         case CHECK_STATE_CONTENT: {
             ret = parse_content(text);
-            if (ret == GET_REQUEST)
-                return do_request();
+            if (ret == GET_REQUEST) {
+                ret = do_request();
+                m_read_buf[m_checked_idx] = m_body_end_char;
+                return ret;
+            }
             // 完成消息体解析后，将line_status变量更改为LINE_OPEN，此时可以跳出循环，完成报文解析任务。但感觉没啥意义，因为一般已经return了，避免死循环吧
             line_status = LINE_OPEN;
             break;
@@ -367,21 +550,29 @@ http_conn::HTTP_CODE http_conn::do_request() {
 
         // 注册校验
         if (*(p + 1) == '3') {
-            char *sql_insert = (char *)malloc(sizeof(char) * 200);
-            strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "', '");
-            strcat(sql_insert, password);
-            strcat(sql_insert, "')");
-
-            // 如果是注册，先检测数据库中是否有重名的
-            // 没有重名的，进行增加数据
-            if (users.find(name) == users.end()) {
+            // 如果是注册，先检测数据库中是否有重名的，以及是否有同名的正在写入
+            // 没有重名的，交给写入线程和其他注册一起批量写入，写入完成后再回复
+            m_lock.lock();
+            bool taken = users.find(name) != users.end() ||
+                         !pending_users.insert(name).second;
+            m_lock.unlock();
+            // 数据库熔断期间注册回复503，通常已经在反应堆中拒绝，这里只检查
+            // 流水线中由工作线程接着处理、没有经过db_admit()的注册；
+            // 登录只查内存表，不受熔断影响
+            if (!taken && !m_db_admitted && !m_db_breaker.allow()) {
                 m_lock.lock();
-                // 错误返回非零值
-                int res = mysql_query(mysql, sql_insert);
-                users.insert(pair<string, string>(name, password));
+                pending_users.erase(name);
+                m_lock.unlock();
+                metrics::get_instance()->add(DB_BREAKER_REJECT);
+                return SERVICE_UNAVAILABLE;
+            }
+            if (!taken) {
+                int res = m_writer->insert(name, password);
+                m_lock.lock();
+                pending_users.erase(name);
+                // 写入失败的用户不放入内存表，之后可以重新注册
+                if (!res)
+                    users.insert(pair<string, string>(name, password));
                 m_lock.unlock();
 
                 if (!res)
@@ -393,7 +584,12 @@ http_conn::HTTP_CODE http_conn::do_request() {
         }
         // 登录校验
         else if (*(p + 1) == '2') {
-            if (users.find(name) != users.end() && users[name] == password)
+            // 注册可能正在其他线程中修改users，查找时也要加锁
+            m_lock.lock();
+            map<string, string>::iterator it = users.find(name);
+            bool match = it != users.end() && it->second == password;
+            m_lock.unlock();
+            if (match)
                 strcpy(m_url, "/welcome.html");
             else
                 strcpy(m_url, "/loginError.html");
@@ -439,9 +635,19 @@ http_conn::HTTP_CODE http_conn::do_request() {
         strncpy(m_real_file + len, m_url, strlen(m_url));
     }
 
-    // 通过stat获取请求资源文件信息，成功则将信息更新到m_file_stat结构体
-    // 失败返回NO_RESOURCE状态，表示资源不存在
-    if (stat(m_real_file, &m_file_stat) < 0)
+    // 优先从共享文件缓存中获取，命中时不需要任何文件相关的系统调用
+    bool stated;
+    m_cache_entry =
+        file_cache::get_instance()->acquire(m_real_file, &m_file_stat, &stated);
+    if (m_cache_entry) {
+        m_file_stat = m_cache_entry->st;
+        m_file_address = m_cache_entry->data;
+        return check_range();
+    }
+
+    // 未缓存（缓存关闭、文件过大或出错），通过stat获取请求资源文件信息，成功则将信息更新到m_file_stat结构体
+    // 缓存已经stat过时直接使用它的结果；失败返回NO_RESOURCE状态，表示资源不存在
+    if (stated ? m_file_stat.st_mode == 0 : stat(m_real_file, &m_file_stat) < 0)
         return NO_RESOURCE;
     // 判断文件的权限，是否可读，不可读则返回FORBIDDEN_REQUEST状态
     if (!(m_file_stat.st_mode & S_IROTH))
@@ -449,97 +655,371 @@ http_conn::HTTP_CODE http_conn::do_request() {
     // 判断文件类型，如果是目录，则返回BAD_REQUEST，表示请求报文有误
     if (S_ISDIR(m_file_stat.st_mode))
         return BAD_REQUEST;
+    // 大文件保持描述符打开，由write()用sendfile从内核直接发送，不做映射
+    if (m_file_stat.st_size >= m_sendfile_threshold) {
+        m_file_fd = open(m_real_file, O_RDONLY);
+        if (m_file_fd < 0)
+            return INTERNAL_ERROR;
+        m_file_offset = 0;
+        return check_range();
+    }
     // 以只读方式获取文件描述符，通过mmap将该文件映射到内存中
     int fd = open(m_real_file, O_RDONLY);
     m_file_address =
         (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     close(fd);
+    return check_range();
+}
+
+// 生成文件的强校验器，由inode、大小和修改时间组成
+void http_conn::get_etag(char *buf, int len) {
+    snprintf(buf, len, "\"%lx-%lx-%lx\"", (unsigned long)m_file_stat.st_ino,
+             (unsigned long)m_file_stat.st_size,
+             (unsigned long)m_file_stat.st_mtime);
+}
+
+void http_conn::get_last_modified(char *buf, int len) {
+    struct tm tm_gmt;
+    gmtime_r(&m_file_stat.st_mtime, &tm_gmt);
+    strftime(buf, len, "%a, %d %b %Y %H:%M:%S GMT", &tm_gmt);
+}
+
+// If-Range与当前文件的ETag或Last-Modified完全一致时Range才生效
+bool http_conn::if_range_match() {
+    char validator[64];
+    if (m_if_range[0] == '"')
+        get_etag(validator, sizeof(validator));
+    else if (strncmp(m_if_range, "W/", 2) == 0)
+        // 弱校验器不能用于范围请求
+        return false;
+    else
+        get_last_modified(validator, sizeof(validator));
+    return strcmp(m_if_range, validator) == 0;
+}
+
+// 解析Range: bytes=a-b,c-,-n
+// 返回0表示忽略Range返回完整文件，1表示有可满足的范围，-1表示都不可满足
+int http_conn::parse_range() {
+    m_range_count = 0;
+    if (!m_range)
+        return 0;
+    if (m_if_range && !if_range_match())
+        return 0;
+    if (strncasecmp(m_range, "bytes=", 6) != 0)
+        return 0;
+
+    off_t size = m_file_stat.st_size;
+    char *p = m_range + 6;
+    while (*p) {
+        p += strspn(p, " \t");
+        off_t start, end;
+        bool satisfiable = true;
+        char *next;
+        if (*p == '-') {
+            // 后缀范围，最后n个字节
+            off_t n = strtoll(p + 1, &next, 10);
+            if (next == p + 1)
+                return 0;
+            if (n == 0 || size == 0)
+                satisfiable = false;
+            start = n >= size ? 0 : size - n;
+            end = size - 1;
+        } else if (*p >= '0' && *p <= '9') {
+            start = strtoll(p, &next, 10);
+            if (*next != '-')
+                return 0;
+            p = next + 1;
+            if (*p >= '0' && *p <= '9') {
+                end = strtoll(p, &next, 10);
+                if (end < start)
+                    return 0;
+            } else {
+                next = p;
+                end = size - 1;
+            }
+            if (start >= size)
+                satisfiable = false;
+            if (end >= size)
+                end = size - 1;
+        } else {
+            return 0;
+        }
+        p = next + strspn(next, " \t");
+        if (*p == ',')
+            ++p;
+        else if (*p != '\0')
+            return 0;
+
+        if (satisfiable) {
+            // 范围过多时退化为完整响应
+            if (m_range_count == MAX_RANGES)
+                return 0;
+            m_ranges[m_range_count].start = start;
+            m_ranges[m_range_count].end = end;
+            ++m_range_count;
+        }
+    }
+    return m_range_count > 0 ? 1 : -1;
+}
+
+// 文件就绪后处理Range请求
+http_conn::HTTP_CODE http_conn::check_range() {
+    int ret = parse_range();
+    if (ret < 0) {
+        unmap();
+        return RANGE_NOT_SATISFIABLE;
+    }
+    // 多个范围需要在iovec中穿插各部分的头部，sendfile模式改为映射文件
+    if (m_range_count > 1 && m_file_fd >= 0) {
+        m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ,
+                                      MAP_PRIVATE, m_file_fd, 0);
+        close(m_file_fd);
+        m_file_fd = -1;
+        if (m_file_address == MAP_FAILED) {
+            m_file_address = 0;
+            return INTERNAL_ERROR;
+        }
+    }
     return FILE_REQUEST;
 }
 
+// 归还当前请求的文件
 void http_conn::unmap() {
-    if (m_file_address) {
+    if (m_file_fd >= 0) {
+        close(m_file_fd);
+        m_file_fd = -1;
+    } else if (m_cache_entry) {
+        file_cache::get_instance()->release(m_cache_entry);
+        m_cache_entry = NULL;
+        m_file_address = 0;
+    } else if (m_file_address) {
         munmap(m_file_address, m_file_stat.st_size);
         m_file_address = 0;
     }
 }
 
+// 响应已排队，文件内容交给m_holds保管到发送完，当前请求可以继续解析下一个
+void http_conn::hold_file() {
+    if (m_file_fd >= 0 || (!m_cache_entry && !m_file_address))
+        return;
+    file_hold &hold = m_holds[m_hold_count++];
+    hold.cache_entry = m_cache_entry;
+    hold.address = m_file_address;
+    hold.size = m_file_stat.st_size;
+    m_cache_entry = NULL;
+    m_file_address = 0;
+}
+
+// 归还所有排队响应引用的文件
+void http_conn::release_files() {
+    unmap();
+    for (int i = 0; i < m_hold_count; ++i) {
+        if (m_holds[i].cache_entry)
+            file_cache::get_instance()->release(m_holds[i].cache_entry);
+        else
+            munmap(m_holds[i].address, m_holds[i].size);
+    }
+    m_hold_count = 0;
+}
+
 bool http_conn::write() {
-    int temp = 0;
+    ssize_t temp = 0;
 
     if (bytes_to_send == 0) {
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
-        init();
+        modfd(m_epollfd, m_sockfd, EPOLLIN, this);
         return true;
     }
 
     while (1) {
-        temp = writev(m_sockfd, m_iv, m_iv_count);
+        bool vec = m_iv_idx < m_iv_count;
+        if (vec) {
+            // 排队的响应一次发出；最后一个响应用sendfile时带上MSG_MORE，
+            // 让内核把响应头和随后的文件内容合并成满载的报文
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = m_iv + m_iv_idx;
+            msg.msg_iovlen = m_iv_count - m_iv_idx;
+            temp = sendmsg(m_sockfd, &msg, m_file_fd >= 0 ? MSG_MORE : 0);
+        } else {
+            // 从上次的偏移处继续发送文件内容，m_file_offset由sendfile更新
+            temp = sendfile(m_sockfd, m_file_fd, &m_file_offset,
+                            bytes_to_send);
+            // 文件在发送过程中被截断
+            if (temp == 0)
+                temp = -1;
+        }
 
         if (temp < 0) {
             if (errno == EAGAIN) {
-                modfd(m_epollfd, m_sockfd, EPOLLOUT);
+                modfd(m_epollfd, m_sockfd, EPOLLOUT, this);
                 return true;
             }
-            unmap();
+            release_files();
             return false;
         }
 
         bytes_have_send += temp;
         bytes_to_send -= temp;
-        if (bytes_have_send >= m_iv[0].iov_len) {
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
-        } else {
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
+        if (vec) {
+            // 跳过已经发送完的iovec，调整发送了一部分的iovec
+            while (m_iv_idx < m_iv_count &&
+                   (size_t)temp >= m_iv[m_iv_idx].iov_len) {
+                temp -= m_iv[m_iv_idx].iov_len;
+                ++m_iv_idx;
+            }
+            if (temp > 0) {
+                m_iv[m_iv_idx].iov_base = (char *)m_iv[m_iv_idx].iov_base + temp;
+                m_iv[m_iv_idx].iov_len -= temp;
+            }
         }
 
         if (bytes_to_send <= 0) {
-            unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
-
-            if (m_linger) {
-                init();
-                return true;
-            } else {
+            release_files();
+            bool linger = m_resp_linger;
+            reset_response();
+            if (!linger)
                 return false;
-            }
+            // 缓冲区中还有流水线请求时由反应堆继续分发，否则等待新的请求
+            if (!has_buffered_request())
+                modfd(m_epollfd, m_sockfd, EPOLLIN, this);
+            return true;
         }
     }
 }
 
 bool http_conn::add_response(const char *format, ...) {
-    if (m_write_idx >= WRITE_BUFFER_SIZE)
-        return false;
     va_list arg_list;
     va_start(arg_list, format);
-    int len = vsnprintf(m_write_buf + m_write_idx,
-                        WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
-    if (len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx)) {
-        va_end(arg_list);
-        return false;
-    }
-    m_write_idx += len;
+    bool ret = m_write_buf.append(format, arg_list);
     va_end(arg_list);
-    LOG_INFO("request:%s", m_write_buf);
+    if (!ret)
+        return false;
+    LOG_INFO("request:%s", m_write_buf.last());
     Log::get_instance()->flush();
     return true;
 }
+
+// 把写缓冲区中还没有加入iovec的内容加入iovec
+bool http_conn::add_buffer_iov() {
+    int n = m_write_buf.take_iov(m_iv + m_iv_count, IOV_SIZE - m_iv_count);
+    if (n < 0)
+        return false;
+    m_iv_count += n;
+    return true;
+}
+
+// 文件内容直接由iovec指向缓存或映射
+bool http_conn::add_file_iov(char *address, size_t len) {
+    if (m_iv_count == IOV_SIZE)
+        return false;
+    m_iv[m_iv_count].iov_base = address;
+    m_iv[m_iv_count].iov_len = len;
+    ++m_iv_count;
+    return true;
+}
 bool http_conn::add_status_line(int status, const char *title) {
     return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
 }
-bool http_conn::add_headers(int content_len) {
-    add_content_length(content_len);
-    add_linger();
-    add_blank_line();
+bool http_conn::add_headers(off_t content_len) {
+    return add_content_length(content_len) && add_linger() &&
+           add_blank_line();
 }
-bool http_conn::add_content_length(int content_len) {
-    return add_response("Content-Length:%d\r\n", content_len);
+bool http_conn::add_content_length(off_t content_len) {
+    return add_response("Content-Length:%lld\r\n", (long long)content_len);
+}
+bool http_conn::add_content_type(const char *type) {
+    return add_response("Content-Type:%s\r\n", type);
+}
+
+// 根据扩展名确定文件类型
+const char *http_conn::get_content_type() {
+    const char *dot = strrchr(m_real_file, '.');
+    if (!dot)
+        return "application/octet-stream";
+    if (strcasecmp(dot, ".html") == 0)
+        return "text/html";
+    if (strcasecmp(dot, ".jpg") == 0 || strcasecmp(dot, ".jpeg") == 0)
+        return "image/jpeg";
+    if (strcasecmp(dot, ".png") == 0)
+        return "image/png";
+    if (strcasecmp(dot, ".gif") == 0)
+        return "image/gif";
+    if (strcasecmp(dot, ".ico") == 0)
+        return "image/x-icon";
+    if (strcasecmp(dot, ".mp4") == 0)
+        return "video/mp4";
+    if (strcasecmp(dot, ".css") == 0)
+        return "text/css";
+    if (strcasecmp(dot, ".js") == 0)
+        return "application/javascript";
+    return "application/octet-stream";
+}
+
+// 文件响应公共的头部：类型、支持范围请求以及校验器
+bool http_conn::add_file_headers() {
+    char etag[64], last_modified[64];
+    get_etag(etag, sizeof(etag));
+    get_last_modified(last_modified, sizeof(last_modified));
+    return add_content_type(get_content_type()) &&
+           add_response("Accept-Ranges:bytes\r\n") &&
+           add_response("Last-Modified:%s\r\n", last_modified) &&
+           add_response("ETag:%s\r\n", etag);
 }
-bool http_conn::add_content_type() {
-    return add_response("Content-Type:%s\r\n", "text/html");
+
+/*
+ * 206响应，文件内容由iovec直接指向缓存或映射，sendfile模式只支持单个范围
+ * 多个范围时先算出各部分头部和结束分隔符的长度得到Content-Length，
+ * 再按 响应头、部分头、部分内容...、结束分隔符 的顺序写入
+ */
+static const char *part_format =
+    "\r\n--%s\r\nContent-Type:%s\r\nContent-Range:bytes %lld-%lld/%lld\r\n\r\n";
+static const char *tail_format = "\r\n--%s--\r\n";
+
+bool http_conn::add_range_response() {
+    off_t size = m_file_stat.st_size;
+    if (m_range_count == 1) {
+        off_t start = m_ranges[0].start, end = m_ranges[0].end;
+        off_t body_len = end - start + 1;
+        if (!add_status_line(206, partial_206_title) || !add_file_headers() ||
+            !add_response("Content-Range:bytes %lld-%lld/%lld\r\n",
+                          (long long)start, (long long)end, (long long)size) ||
+            !add_headers(body_len) || !add_buffer_iov())
+            return false;
+        if (m_file_fd >= 0) {
+            m_file_offset = start;
+            bytes_to_send += body_len;
+            return true;
+        }
+        return add_file_iov(m_file_address + start, body_len);
+    }
+
+    const char *type = get_content_type();
+    off_t body_len = 0;
+    for (int i = 0; i < m_range_count; ++i) {
+        off_t start = m_ranges[i].start, end = m_ranges[i].end;
+        body_len += snprintf(NULL, 0, part_format, range_boundary, type,
+                             (long long)start, (long long)end,
+                             (long long)size) +
+                    (end - start + 1);
+    }
+    body_len += snprintf(NULL, 0, tail_format, range_boundary);
+
+    char content_type[128];
+    snprintf(content_type, sizeof(content_type),
+             "multipart/byteranges; boundary=%s", range_boundary);
+    if (!add_status_line(206, partial_206_title) ||
+        !add_content_type(content_type) ||
+        !add_response("Accept-Ranges:bytes\r\n") || !add_headers(body_len))
+        return false;
+    for (int i = 0; i < m_range_count; ++i) {
+        off_t start = m_ranges[i].start, end = m_ranges[i].end;
+        if (!add_response(part_format, range_boundary, type, (long long)start,
+                          (long long)end, (long long)size) ||
+            !add_buffer_iov() ||
+            !add_file_iov(m_file_address + start, end - start + 1))
+            return false;
+    }
+    return add_response(tail_format, range_boundary) && add_buffer_iov();
 }
 bool http_conn::add_linger() {
     return add_response("Connection:%s\r\n",
@@ -550,7 +1030,10 @@ bool http_conn::add_content(const char *content) {
     return add_response("%s", content);
 }
 
+// 响应追加在已排队的响应之后
 bool http_conn::process_write(HTTP_CODE ret) {
+    size_t resp_start = m_write_buf.size();
+    int iv_start = m_iv_count;
     switch (ret) {
     case INTERNAL_ERROR: {
         // 内部错误，500
@@ -576,46 +1059,125 @@ bool http_conn::process_write(HTTP_CODE ret) {
             return false;
         break;
     }
+    case SERVICE_UNAVAILABLE: {
+        // 过载，503，建议客户端稍后重试
+        add_status_line(503, error_503_title);
+        add_response("Retry-After:%d\r\n", RETRY_AFTER);
+        add_headers(strlen(error_503_form));
+        if (!add_content(error_503_form))
+            return false;
+        break;
+    }
+    case RANGE_NOT_SATISFIABLE: {
+        // 请求的范围都超出了文件大小，416
+        add_status_line(416, error_416_title);
+        add_response("Content-Range:bytes */%lld\r\n",
+                     (long long)m_file_stat.st_size);
+        add_headers(strlen(error_416_form));
+        if (!add_content(error_416_form))
+            return false;
+        break;
+    }
     case FILE_REQUEST: {
-        // 文件存在，200
-        add_status_line(200, ok_200_title);
-        if (m_file_stat.st_size != 0) {
-            add_headers(m_file_stat.st_size);
-            m_iv[0].iov_base = m_write_buf;
-            m_iv[0].iov_len = m_write_idx;
-            m_iv[1].iov_base = m_file_address;
-            m_iv[1].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
-            bytes_to_send = m_write_idx + m_file_stat.st_size;
-            return true;
-        } else {
+        bool ok = false;
+        if (m_range_count > 0) {
+            // 范围请求，206；响应头写不下时退化为完整的200响应
+            ok = add_range_response();
+            if (!ok) {
+                m_write_buf.truncate(resp_start);
+                m_iv_count = iv_start;
+                m_range_count = 0;
+                m_file_offset = 0;
+            }
+        }
+        if (!ok && m_file_stat.st_size == 0) {
             const char *ok_string = "<html><body></body></html>";
+            unmap();
+            add_status_line(200, ok_200_title);
+            add_file_headers();
             add_headers(strlen(ok_string));
             if (!add_content(ok_string))
                 return false;
+            break;
+        }
+        if (!ok) {
+            // 文件存在，200
+            if (!add_status_line(200, ok_200_title) || !add_file_headers() ||
+                !add_headers(m_file_stat.st_size) || !add_buffer_iov())
+                return false;
+            if (m_file_fd >= 0)
+                // sendfile模式，iovec中只有响应头
+                bytes_to_send += m_file_stat.st_size;
+            else if (!add_file_iov(m_file_address, m_file_stat.st_size))
+                return false;
         }
+        hold_file();
+        for (int i = iv_start; i < m_iv_count; ++i)
+            bytes_to_send += m_iv[i].iov_len;
+        return true;
     }
     default:
         return false;
     }
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 1;
-    bytes_to_send = m_write_idx;
+    if (!add_buffer_iov())
+        return false;
+    for (int i = iv_start; i < m_iv_count; ++i)
+        bytes_to_send += m_iv[i].iov_len;
     return true;
 }
 
+// 由反应堆在请求队列已满时、或由工作线程在请求排队过久时调用，
+// 此时连接上没有待发送的响应；读缓冲区中的请求都不再处理
+void http_conn::reject() {
+    reset_request();
+    m_start_line = 0;
+    m_checked_idx = 0;
+    m_read_idx = 0;
+    release_read_buf();
+    if (process_write(SERVICE_UNAVAILABLE)) {
+        m_resp_linger = false;
+        ++m_resp_count;
+    }
+    modfd(m_epollfd, m_sockfd, EPOLLOUT, this);
+}
+
 // 由线程池中的工作线程调用，这是处理HTTP请求的入口函数
+// 一次处理读缓冲区中所有完整的请求（HTTP/1.1流水线），响应按请求顺序排队后一起发送
 void http_conn::process() {
-    HTTP_CODE read_ret = process_read();
-    // http报文不完整，重置
-    if (read_ret == NO_REQUEST) {
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
-        return;
+    while (true) {
+        // 后续的请求属于其他通道时留给反应堆在发送完响应后重新分发
+        if (next_lane() != lane)
+            break;
+        HTTP_CODE read_ret = process_read();
+        // http报文不完整，等待后续数据
+        if (read_ret == NO_REQUEST)
+            break;
+        if (!process_write(read_ret)) {
+            // 连接和定时器只能由反应堆释放：这里只关闭socket的读写并重新注册，
+            // 反应堆收到挂断事件后按对端关闭处理，finish()之后删除定时器并释放，
+            // 不计为超时
+            shutdown(m_sockfd, SHUT_RDWR);
+            modfd(m_epollfd, m_sockfd, EPOLLIN, this);
+            return;
+        }
+        // 报文有语法错误时无法确定下一个请求的起点，发送完响应后关闭连接
+        m_resp_linger = m_linger && read_ret != BAD_REQUEST;
+        ++m_resp_count;
+        reset_request();
+
+        // 非keep-alive、sendfile响应只能排在最后，或者剩余空间可能放不下下一个响应
+        if (!m_resp_linger || m_file_fd >= 0 ||
+            m_resp_count >= MAX_PIPELINE ||
+            m_iv_count + RESPONSE_IOV > IOV_SIZE)
+            break;
     }
-    bool write_ret = process_write(read_ret);
-    if (!write_ret) {
-        close_conn();
+    compact_read_buf();
+    // 没有未处理的数据，连接进入空闲，归还读缓冲区
+    if (m_read_idx == 0)
+        release_read_buf();
+    if (m_resp_count == 0) {
+        modfd(m_epollfd, m_sockfd, EPOLLIN, this);
+        return;
     }
-    modfd(m_epollfd, m_sockfd, EPOLLOUT);
+    modfd(m_epollfd, m_sockfd, EPOLLOUT, this);
 }
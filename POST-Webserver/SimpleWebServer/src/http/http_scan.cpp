@@ -0,0 +1,119 @@
+#include "http_scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+/*
+ * 每种实现都是查找[p, end)中第一个属于字符集合{C0, C1, C2}的字节，
+ * 集合大小N为2或3，集合在编译期确定
+ */
+
+// 标量实现，同时用于处理向量实现中不足一个向量的尾部
+template <char C0, char C1, char C2, int N>
+static const char *find_scalar(const char *p, const char *end) {
+    for (; p < end; ++p) {
+        char c = *p;
+        if (c == C0 || c == C1 || (N > 2 && c == C2))
+            return p;
+    }
+    return end;
+}
+
+#ifdef SCAN_X86
+// pcmpestri一条指令完成16个字节与字符集合的比较，返回第一个匹配的下标，没有时为16
+// 显式长度的比较中'\0'也是普通的集合元素
+template <char C0, char C1, char C2, int N>
+__attribute__((target("sse4.2"))) static const char *
+find_sse42(const char *p, const char *end) {
+    const __m128i set =
+        _mm_setr_epi8(C0, C1, C2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    for (; end - p >= 16; p += 16) {
+        __m128i data = _mm_loadu_si128((const __m128i *)p);
+        int idx = _mm_cmpestri(set, N, data, 16,
+                               _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY |
+                                   _SIDD_LEAST_SIGNIFICANT);
+        if (idx != 16)
+            return p + idx;
+    }
+    return find_scalar<C0, C1, C2, N>(p, end);
+}
+
+// AVX2没有字符集合比较指令，对每个字符分别比较后合并掩码
+template <char C0, char C1, char C2, int N>
+__attribute__((target("avx2"))) static const char *
+find_avx2(const char *p, const char *end) {
+    const __m256i c0 = _mm256_set1_epi8(C0);
+    const __m256i c1 = _mm256_set1_epi8(C1);
+    const __m256i c2 = _mm256_set1_epi8(C2);
+    for (; end - p >= 32; p += 32) {
+        __m256i data = _mm256_loadu_si256((const __m256i *)p);
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(data, c0),
+                                      _mm256_cmpeq_epi8(data, c1));
+        if (N > 2)
+            hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(data, c2));
+        unsigned mask = _mm256_movemask_epi8(hit);
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+    return find_sse42<C0, C1, C2, N>(p, end);
+}
+#endif
+
+typedef const char *(*scan_fn)(const char *, const char *);
+
+struct scan_impl {
+    const char *name;
+    scan_fn line_end;
+    scan_fn space;
+    scan_fn colon;
+};
+
+#define SCAN_IMPL(name, f)                                                     \
+    {                                                                          \
+        name, f<'\r', '\n', 0, 2>, f<' ', '\t', '\0', 3>, f<':', '\0', 0, 2>  \
+    }
+
+static const scan_impl impls[] = {
+    SCAN_IMPL("scalar", find_scalar),
+#ifdef SCAN_X86
+    SCAN_IMPL("sse4.2", find_sse42),
+    SCAN_IMPL("avx2", find_avx2),
+#endif
+};
+
+SCAN_LEVEL scan_best_level() {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return SCAN_AVX2;
+    if (__builtin_cpu_supports("sse4.2"))
+        return SCAN_SSE42;
+#endif
+    return SCAN_SCALAR;
+}
+
+// 程序启动时选择一次，之后只读
+static const scan_impl *cur_impl = &impls[scan_best_level()];
+
+bool scan_select(SCAN_LEVEL level) {
+    if (level < SCAN_SCALAR || level > scan_best_level())
+        return false;
+    cur_impl = &impls[level];
+    return true;
+}
+
+const char *scan_impl_name() { return cur_impl->name; }
+
+const char *scan_line_end(const char *p, const char *end) {
+    return cur_impl->line_end(p, end);
+}
+
+const char *scan_space(const char *p, const char *end) {
+    return cur_impl->space(p, end);
+}
+
+const char *scan_colon(const char *p, const char *end) {
+    return cur_impl->colon(p, end);
+}
@@ -2,45 +2,31 @@
 #include <cassert>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <netinet/in.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/epoll.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
-#include "heap_timer.h"
+#include "batch_writer.h"
+#include "file_cache.h"
 #include "http_conn.h"
 #include "locker.h"
 #include "log.h"
+#include "metrics.h"
+#include "placement.h"
+#include "reactor.h"
 #include "sql_connection_pool.h"
 #include "threadpool.h"
 
-#define MAX_FD 65536           // 最大文件描述符
-#define MAX_EVENT_NUMBER 10000 // 最大事件数
-#define TIMESLOT 5             // 最小超时单位
-
-// 这三个函数在http_conn.cpp中定义，改变链接属性
-extern int addfd(int epollfd, int fd, bool one_shot);
-extern int remove(int epollfd, int fd);
+// 这个函数在http_conn.cpp中定义，改变链接属性
 extern int setnonblocking(int fd);
 
-// 设置定时器相关参数
-static int pipefd[2];
-// static sort_timer_lst timer_lst; // 定时器双向链表
-static HeapTimer timer_lst; // 定时器双向链表
-
-static int epollfd = 0;
-
-// 信号处理函数
-void sig_handler(int sig) {
-    // 为保证函数的可重入性，保留原来的errno
-    int save_errno = errno;
-    int msg = sig;
-    send(pipefd[1], (char *)&msg, 1, 0);
-    errno = save_errno;
-}
-
 // 设置信号函数
 void addsig(int sig, void(handler)(int), bool restart = true) {
     struct sigaction sa;
@@ -54,67 +40,8 @@ void addsig(int sig, void(handler)(int), bool restart = true) {
     assert(sigaction(sig, &sa, NULL) != -1);
 }
 
-// 定时器到达处理任务，重新定时以不断触发SIGALRM信号
-void timer_handler() {
-    timer_lst.tick();
-    alarm(TIMESLOT);
-}
-
-// 定时器回调函数，删除非活动连接在socket上的注册事件，并关闭
-void cb_func(client_data *user_data) {
-    epoll_ctl(epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
-    assert(user_data);
-    close(user_data->sockfd);
-    http_conn::m_user_count--;
-
-    // 输出日志
-    LOG_INFO("close fd %d", user_data->sockfd);
-    // printf("close fd %d \n", user_data->sockfd);
-    Log::get_instance()->flush();
-}
-
-// 连接个数过多，返回错误信息，并断开连接
-void show_error(int connfd, const char *info) {
-    // printf("%s", info);
-    LOG_ERROR("accept numbers are too big!, %s", info);
-    Log::get_instance()->flush();
-    send(connfd, info, strlen(info), 0);
-    close(connfd);
-}
-
-int main(int argc, char *argv[]) {
-    // 异步日志
-    Log::get_instance()->init("ServerLog", 8192, 800000, 500);
-
-    // 设置的端口
-    if (argc <= 1) {
-        printf("usage: %s ip_address port_number\n", basename(argv[0]));
-        return 1;
-    }
-    int port = atoi(argv[1]);
-
-    // 忽略管道的差错信号，避免程序意外退出
-    addsig(SIGPIPE, SIG_IGN);
-
-    // 创建数据库连接池
-    connection_pool *connPool = connection_pool::GetInstance();
-    connPool->init("localhost", "dbname", "dbPasswd", "mydatabase", 3306, 8);
-
-    // 创建线程池
-    threadpool<http_conn> *pool = NULL;
-    try {
-        pool = new threadpool<http_conn>(connPool);
-    } catch (...) {
-        return 1;
-    }
-
-    // 直接开辟所有文件描述符的连接
-    http_conn *users = new http_conn[MAX_FD];
-    assert(users);
-
-    // 初始化数据库读取表
-    users->initmysql_result(connPool);
-
+// 创建监听socket，多反应堆模式下开启SO_REUSEPORT，由内核在各监听socket间分发连接
+static int create_listenfd(int port, bool reuseport) {
     int listenfd = socket(PF_INET, SOCK_STREAM, 0);
     assert(listenfd >= 0);
     // 设置为非阻塞
@@ -123,6 +50,8 @@ int main(int argc, char *argv[]) {
     int flag = 1;
     // 强制使用被处于TIME_WAIT状态的连接占用的socket地址
     setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    if (reuseport)
+        setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag));
 
     int ret = 0;
     struct sockaddr_in address;
@@ -135,197 +64,338 @@ int main(int argc, char *argv[]) {
     assert(ret >= 0);
     ret = listen(listenfd, 5);
     assert(ret >= 0);
+    return listenfd;
+}
 
-    // 创建内核事件表
-    epoll_event events[MAX_EVENT_NUMBER];
-    epollfd = epoll_create(5);
-    assert(epollfd != -1);
-
-    /*
-    监听listenfd上是不能注册EPOLLONESHOT事件的；
-    但是对于socket的读、写事件，应注册为EPOLLONESHOT来保证一个socket连接
-    在任一时刻都只被一个线程处理
-    */
-    addfd(epollfd, listenfd, false);
-    http_conn::m_epollfd = epollfd;
-
-    // 创建管道
-    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
-    assert(ret != -1);
-    // 设置管道写端为非阻塞
-    setnonblocking(pipefd[1]);
-
-    // 设置管道读端为ET非阻塞，非一次性
-    addfd(epollfd, pipefd[0], false);
-
-    // 添加程序结束的信号
-    addsig(SIGALRM, sig_handler);
-    // 添加闹钟信号
-    addsig(SIGTERM, sig_handler);
+// 按RLIMIT_NOFILE确定最大连接数，软限制先提高到硬限制
+// 预留一部分描述符给监听socket、信号管道、日志文件、数据库连接和大文件
+static int max_connections() {
+    const int reserved = 64;
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0)
+        return 1024 - reserved;
+    if (limit.rlim_cur < limit.rlim_max) {
+        rlim_t cur = limit.rlim_cur;
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &limit) < 0)
+            limit.rlim_cur = cur;
+    }
+    // 大文件用sendfile发送时每个连接还要多占一个描述符
+    rlim_t n = limit.rlim_cur > (rlim_t)reserved * 2
+                   ? (limit.rlim_cur - reserved) / 2
+                   : reserved;
+    if (n > 1 << 24)
+        n = 1 << 24;
+    return (int)n;
+}
 
-    // 循环条件，优雅退出
-    bool stop_server = false;
+// 解析[min, max]范围内的十进制整数，不是整数、有多余字符或超出范围时返回false
+static bool parse_int(const char *arg, long min, long max, int *value) {
+    char *end;
+    errno = 0;
+    long n = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0' || errno == ERANGE || n < min || n > max)
+        return false;
+    *value = (int)n;
+    return true;
+}
 
-    client_data *users_timer = new client_data[MAX_FD];
+// 解析"读头部,读请求体,空闲,发送"的超时秒数，可以只给出前几项，其余保持默认
+static bool set_timeouts(const char *arg) {
+    int sec[http_conn::PHASE_NUMBER];
+    int n = sscanf(arg, "%d,%d,%d,%d", &sec[0], &sec[1], &sec[2], &sec[3]);
+    if (n <= 0)
+        return false;
+    for (int i = 0; i < n; ++i) {
+        if (sec[i] <= 0)
+            return false;
+        reactor::m_timeouts[i] = sec[i] * 1000;
+    }
+    return true;
+}
 
-    bool timeout = false;
+int main(int argc, char *argv[]) {
+    // 在创建任何线程之前屏蔽SIGTERM，之后创建的线程都继承这个屏蔽字，
+    // SIGTERM只能通过signalfd在事件循环中读取，不会打断其他线程的系统调用
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
 
-    // 开始循环定时
-    alarm(TIMESLOT);
+    // 异步日志
+    Log::get_instance()->init("ServerLog", 8192, 800000, 500);
 
-    while (!stop_server) {
-        int number = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
-        if (number < 0 && errno != EINTR) {
-            LOG_ERROR("%s", "epoll failure");
-            Log::get_instance()->flush();
+    // 运行模式：0为半同步/半反应堆，1为one loop per thread多反应堆
+    int actor_model = 0;
+    // 多反应堆模式下的反应堆线程数
+    int reactor_number = 4;
+    // 静态文件缓存大小，单位MB，0表示关闭
+    int cache_mb = 64;
+    // 不小于该大小（KB）的文件改用sendfile发送，同时不进入缓存
+    int sendfile_kb = 1024;
+    // 线程池的请求分配：0为共用一个队列，1为每个线程一个队列并互相窃取
+    int schedule = 0;
+    // 读头部、读请求体、keep-alive空闲、发送无进展的超时，单位秒，逗号分隔
+    const char *timeouts = NULL;
+    // 线程池的常驻线程数、最大线程数和多出的线程空闲多少秒后退出，逗号分隔
+    int min_threads = 8, max_threads = 8, idle_sec = 30;
+    // 反应堆线程和工作线程绑定的CPU，格式为"反应堆CPU列表/工作线程CPU列表"
+    const char *affinity = NULL;
+    // 静态文件通道的请求队列长度，队列满时新请求直接回复503
+    int max_requests = 10000;
+    // 数据库通道的线程数和请求队列长度；批量写入时线程只等待写入线程，不占用连接，
+    // 线程数决定每批最多能合并多少注册；直接写入时线程数不超过连接数才不会阻塞在取连接上
+    int db_threads = 16, db_requests = 1000;
+    // 数据库连接池保持的最少连接数、最大连接数、多余连接空闲多少秒后关闭、检查空闲连接的间隔秒数
+    int db_min = 4, db_max = 8, db_idle_sec = 60, db_ping_sec = 30;
+    // 取数据库连接的超时毫秒数，熔断器的连续失败次数、慢查询毫秒数和断开秒数
+    int db_acquire_ms = 1000, db_failures = 5, db_slow_ms = 1000,
+        db_open_sec = 5;
+    // 按排队时间丢弃请求的目标排队时间和统计窗口，单位毫秒，0表示关闭
+    int codel_target_ms = 0, codel_interval_ms = 100;
+    // 1表示每个线程独占一条数据库连接
+    int thread_conn = 0;
+    // 注册用户批量写入时每批最多的行数，为1时每次注册直接写入
+    // 处理线程等到所在批次写入后才回复，每批实际的行数不超过数据库通道的线程数
+    int batch_rows = 16;
+    int opt;
+    while ((opt = getopt(argc, argv, "m:r:c:f:t:s:a:w:q:b:p:k:d:o:g:")) != -1) {
+        switch (opt) {
+        case 'm':
+            actor_model = atoi(optarg);
+            break;
+        case 'r':
+            reactor_number = atoi(optarg);
+            break;
+        case 'c':
+            if (!parse_int(optarg, 0, INT_MAX, &cache_mb)) {
+                printf("bad cache size %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'f':
+            if (!parse_int(optarg, 1, INT_MAX, &sendfile_kb)) {
+                printf("bad sendfile threshold %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 't':
+            timeouts = optarg;
+            break;
+        case 's':
+            schedule = atoi(optarg);
+            break;
+        case 'a':
+            affinity = optarg;
+            break;
+        case 'w':
+            if (sscanf(optarg, "%d,%d,%d", &min_threads, &max_threads,
+                       &idle_sec) < 2 ||
+                min_threads <= 0 || max_threads < min_threads ||
+                idle_sec <= 0) {
+                printf("bad threads %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'q':
+            max_requests = atoi(optarg);
+            break;
+        case 'b':
+            if (sscanf(optarg, "%d,%d", &db_threads, &db_requests) < 1 ||
+                db_threads <= 0 || db_requests <= 0) {
+                printf("bad db lane %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'p':
+            if (sscanf(optarg, "%d,%d,%d,%d", &db_min, &db_max, &db_idle_sec,
+                       &db_ping_sec) < 2 ||
+                db_min < 0 || db_max <= 0 || db_max < db_min ||
+                db_idle_sec <= 0 ||
+                db_ping_sec <= 0) {
+                printf("bad mysql pool %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'k':
+            if (sscanf(optarg, "%d,%d,%d,%d", &db_acquire_ms, &db_failures,
+                       &db_slow_ms, &db_open_sec) < 1 ||
+                db_acquire_ms < 0 || db_failures < 0 || db_slow_ms <= 0 || db_open_sec <= 0) {
+                printf("bad mysql breaker %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'd':
+            if (sscanf(optarg, "%d,%d", &codel_target_ms,
+                       &codel_interval_ms) < 1 ||
+                codel_target_ms < 0 || codel_interval_ms <= 0) {
+                printf("bad codel %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'o':
+            thread_conn = atoi(optarg);
+            break;
+        case 'g':
+            // 每种行数占用一条预处理语句，行数不能超过语句缓存的个数
+            if (!parse_int(optarg, 1, batch_writer::MAX_ROWS, &batch_rows)) {
+                printf("bad batch rows %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
             break;
         }
+    }
 
-        for (int i = 0; i < number; i++) {
-            int sockfd = events[i].data.fd;
+    // 设置的端口
+    if (optind >= argc || reactor_number <= 0 || max_requests <= 0) {
+        printf("usage: %s port_number [-m actor_model] [-r reactor_number] "
+               "[-c cache_mb] [-f sendfile_kb] "
+               "[-t header,body,idle,write] [-s schedule] "
+               "[-a reactor_cpus/worker_cpus] [-w min,max[,idle_sec]] "
+               "[-q queue_len] [-b db_threads[,db_queue_len]] "
+               "[-p min,max[,idle_sec[,ping_sec]]] "
+               "[-k acquire_ms[,failures[,slow_ms[,open_sec]]]] "
+               "[-d target_ms[,interval_ms]] [-o thread_conn] [-g batch_rows]\n",
+               basename(argv[0]));
+        return 1;
+    }
+    int port = atoi(argv[optind]);
+    if (timeouts && !set_timeouts(timeouts)) {
+        printf("bad timeouts %s\n", timeouts);
+        return 1;
+    }
 
-            // 处理新到的客户连接
-            if (sockfd == listenfd) {
-                struct sockaddr_in client_address;
-                socklen_t client_addrlength = sizeof(client_address);
-                while (1) {
-                    // 非阻塞，因为是ET模式，所以需要while循环
-                    int connfd =
-                        accept(listenfd, (struct sockaddr *)&client_address,
-                               &client_addrlength);
-                    if (connfd < 0) {
-                        // 此时已经没有连接了，或者是连接出错了
-                        LOG_ERROR("%s:errno is:%d", "accept error", errno);
-                        Log::get_instance()->flush();
-                        break;
-                    }
-                    if (http_conn::m_user_count >= MAX_FD) {
-                        show_error(connfd, "Internal server is busy");
-                        break;
-                    }
-                    users[connfd].init(connfd, client_address);
+    // 读取CPU和NUMA拓扑，按配置在各线程启动时绑定
+    placement *place = placement::get_instance();
+    place->init();
+    if (affinity && !place->configure(affinity)) {
+        printf("bad affinity %s\n", affinity);
+        return 1;
+    }
+    place->log_topology();
 
-                    // 初始化client_data数据
-                    // 创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到链表中
-                    users_timer[connfd].address = client_address;
-                    users_timer[connfd].sockfd = connfd;
-                    util_timer *timer = new util_timer;
-                    timer->user_data = &users_timer[connfd];
-                    timer->cb_func = cb_func;
-                    time_t cur = time(NULL);
-                    // 设置定时数据
-                    timer->expire = cur + 3 * TIMESLOT;
-                    users_timer[connfd].timer = timer;
-                    timer_lst.add_timer(timer);
-                }
-                continue;
-            }
-            // 客户端关闭连接，移除对应的定时器
-            else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
-                util_timer *timer = users_timer[sockfd].timer;
-                timer->cb_func(&users_timer[sockfd]);
+    // 忽略管道的差错信号，避免程序意外退出
+    addsig(SIGPIPE, SIG_IGN);
 
-                if (timer) {
-                    timer_lst.del_timer(timer);
-                }
-            }
+    // 初始化进程内共享的静态文件缓存，走sendfile的大文件不缓存
+    http_conn::m_sendfile_threshold = (off_t)sendfile_kb << 10;
+    file_cache::get_instance()->init((size_t)cache_mb << 20,
+                                     http_conn::m_sendfile_threshold - 1);
 
-            // 处理信号，即管道的读端
-            else if ((sockfd == pipefd[0]) && (events[i].events & EPOLLIN)) {
-                int sig;
-                char signals[1024];
-                ret = recv(pipefd[0], signals, sizeof(signals), 0);
-                if (ret == -1) {
-                    continue;
-                } else if (ret == 0) {
-                    continue;
-                } else {
-                    for (int i = 0; i < ret; ++i) {
-                        switch (signals[i]) {
-                        case SIGALRM: {
-                            // 定时器到了
-                            timeout = true;
-                            break;
-                        }
-                        case SIGTERM: {
-                            // 退出程序
-                            stop_server = true;
-                            LOG_INFO("%s", "program exit!");
-                            Log::get_instance()->flush();
-                        }
-                        default:
-                            break;
-                        }
-                    }
-                }
-            }
+    // 创建数据库连接池
+    connection_pool *connPool = connection_pool::GetInstance();
+    connPool->init("localhost", "dbname", "dbPasswd", "mydatabase", 3306,
+                   db_min, db_max, db_idle_sec, db_ping_sec);
+    connPool->SetAcquireTimeout(db_acquire_ms);
+    connPool->SetThreadAffine(thread_conn != 0);
+    http_conn::m_db_breaker.init(db_failures, db_slow_ms, db_open_sec * 1000);
+    // 注册用户的写入线程，与其他线程一样从连接池取连接
+    batch_writer *writer = batch_writer::get_instance();
+    if (!writer->init(connPool, &http_conn::m_db_breaker, batch_rows))
+        return 1;
+    http_conn::m_writer = writer;
+    if (batch_rows > 1 && actor_model == 0 && db_threads < batch_rows) {
+        LOG_INFO("batch rows %d limited by %d db lane threads", batch_rows,
+                 db_threads);
+        Log::get_instance()->flush();
+    }
 
-            // 处理客户连接上接收到的数据
-            else if (events[i].events & EPOLLIN) {
-                util_timer *timer = users_timer[sockfd].timer;
-                if (users[sockfd].read_once()) {
-                    LOG_INFO("deal with the client(%s)",
-                             inet_ntoa(users[sockfd].get_address()->sin_addr));
-                    Log::get_instance()->flush();
+    // 创建线程池，多反应堆模式下请求在反应堆线程中直接处理，不需要线程池
+    // 静态文件通道的线程数可以伸缩；数据库通道的线程数固定
+    threadpool<http_conn> *pools[http_conn::LANE_NUMBER] = {NULL, NULL};
+    if (schedule != SCHEDULE_SHARED && schedule != SCHEDULE_STEALING) {
+        printf("unknown schedule %d\n", schedule);
+        return 1;
+    }
+    if (actor_model == 0) {
+        try {
+            pools[http_conn::LANE_STATIC] = new threadpool<http_conn>(
+                min_threads, max_requests, (SCHEDULE)schedule,
+                max_threads, idle_sec * 1000, STATIC_POOL_METRICS);
+            pools[http_conn::LANE_DB] = new threadpool<http_conn>(
+                db_threads, db_requests, SCHEDULE_SHARED, 0,
+                idle_sec * 1000, DB_POOL_METRICS);
+        } catch (...) {
+            printf("create threadpool failure\n");
+            return 1;
+        }
+        for (int i = 0; codel_target_ms > 0 && i < http_conn::LANE_NUMBER;
+             ++i)
+            pools[i]->set_codel(codel_target_ms * 1000LL,
+                                codel_interval_ms * 1000LL);
+    } else if (actor_model != 1) {
+        printf("unknown actor_model %d\n", actor_model);
+        return 1;
+    }
 
-                    // 若监测到读事件，将该http事件放入请求队列
-                    pool->append(users + sockfd);
+    // 初始化数据库读取表
+    http_conn::initmysql_result(connPool);
+    // 主线程在半同步模式下不再访问数据库，不独占连接
+    connPool->ReleaseThread();
+
+    // 连接对象在accept时由各反应堆的slab按需创建
+    int max_conns = max_connections();
+
+    // 每个反应堆一个监听socket、一个epoll内核事件表、一个定时器容器和一个连接slab
+    if (actor_model == 0)
+        reactor_number = 1;
+    int *listenfds = new int[reactor_number];
+    reactor **reactors = new reactor *[reactor_number];
+    try {
+        for (int i = 0; i < reactor_number; ++i) {
+            listenfds[i] = create_listenfd(port, actor_model == 1);
+            reactors[i] = new reactor(listenfds[i], max_conns, pools);
+        }
+    } catch (...) {
+        return 1;
+    }
 
-                    // 若有数据传输，则将定时器往后延迟3个单位
-                    // 并对新的定时器在链表上的位置进行调整
-                    if (timer) {
-                        time_t cur = time(NULL);
-                        timer->expire = cur + 3 * TIMESLOT;
-                        LOG_INFO("%s", "adjust timer once");
-                        Log::get_instance()->flush();
-                        timer_lst.adjust_timer(timer);
-                    }
-                } else {
-                    // 关闭连接并移除定时器
-                    timer->cb_func(&users_timer[sockfd]);
-                    if (timer) {
-                        timer_lst.del_timer(timer);
-                    }
-                }
-            }
-            // 处理客户连接上的发送数据
-            else if (events[i].events & EPOLLOUT) {
-                util_timer *timer = users_timer[sockfd].timer;
-                if (users[sockfd].write()) {
-                    LOG_INFO("send data to the client(%s)",
-                             inet_ntoa(users[sockfd].get_address()->sin_addr));
-                    Log::get_instance()->flush();
+    // 0号反应堆运行在主线程，负责处理信号，其余反应堆各自一个线程
+    int sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    assert(sigfd != -1);
+    reactors[0]->set_signal_fd(sigfd);
 
-                    // 若有数据传输，则将定时器往后延迟3个单位
-                    // 并对新的定时器在链表上的位置进行调整
-                    if (timer) {
-                        time_t cur = time(NULL);
-                        timer->expire = cur + 3 * TIMESLOT;
-                        LOG_INFO("%s", "adjust timer once");
-                        Log::get_instance()->flush();
-                        timer_lst.adjust_timer(timer);
-                    }
-                } else {
-                    timer->cb_func(&users_timer[sockfd]);
-                    if (timer) {
-                        timer_lst.del_timer(timer);
-                    }
-                }
-            }
-        }
-        // 处理定时器为非必须事件，收到信号并不是立马处理
-        // 完成读写事件后，再进行处理
-        if (timeout) {
-            timer_handler();
-            timeout = false;
+    for (int i = 1; i < reactor_number; ++i) {
+        if (!reactors[i]->start()) {
+            LOG_ERROR("%s", "create reactor thread failure");
+            Log::get_instance()->flush();
+            return 1;
         }
     }
-    close(epollfd);
-    close(listenfd);
-    close(pipefd[1]);
-    close(pipefd[0]);
-    delete[] users;
-    delete[] users_timer;
-    delete pool;
+    LOG_INFO("server start, actor_model %d, reactor_number %d, "
+             "schedule %d, threads %d-%d, queue_len %d, db lane %d threads "
+             "queue_len %d, mysql pool %d-%d, acquire %d ms, breaker %d/%d ms/"
+             "%d s, codel %d/%d ms, thread_conn %d, batch_rows %d, "
+             "max_conns %d, timeouts %d/%d/%d/%d ms",
+             actor_model, reactor_number, schedule, min_threads,
+             max_threads, max_requests, db_threads, db_requests, db_min,
+             db_max, db_acquire_ms, db_failures, db_slow_ms, db_open_sec,
+             codel_target_ms, codel_interval_ms, thread_conn, batch_rows,
+             max_conns, reactor::m_timeouts[0], reactor::m_timeouts[1],
+             reactor::m_timeouts[2], reactor::m_timeouts[3]);
+    Log::get_instance()->flush();
+
+    reactors[0]->loop();
+
+    // 主反应堆退出后唤醒其余反应堆退出
+    reactor::m_stop_server = true;
+    for (int i = 1; i < reactor_number; ++i) {
+        reactors[i]->wakeup();
+        reactors[i]->join();
+    }
+    // 先等工作线程处理完手上的请求，它们还会访问连接对象和反应堆的epoll内核事件表
+    for (int i = 0; i < http_conn::LANE_NUMBER; ++i)
+        delete pools[i];
+    writer->stop();
+    for (int i = 0; i < reactor_number; ++i) {
+        delete reactors[i];
+        close(listenfds[i]);
+    }
+    close(sigfd);
+    metrics::get_instance()->report();
+    delete[] reactors;
+    delete[] listenfds;
     return 0;
 }
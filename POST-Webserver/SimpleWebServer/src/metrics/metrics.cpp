@@ -0,0 +1,40 @@
+#include <stdio.h>
+
+#include "log.h"
+#include "metrics.h"
+
+// 与METRIC的顺序一致
+static const char *metric_names[METRIC_NUMBER] = {
+    "timeout_header", "timeout_body", "timeout_idle", "timeout_write",
+    "alloc_slab_chunk", "alloc_block", "free_block",
+    "db_conn_open", "db_conn_busy", "db_conn_create", "db_conn_close",
+    "db_conn_reconnect", "db_conn_fail", "db_conn_affine",
+    "db_stmt_prepare", "db_batch", "db_batch_rows", "db_acquire_timeout",
+    "db_breaker_open", "db_breaker_reject",
+    "db_wait_lt_100us", "db_wait_lt_1ms", "db_wait_lt_10ms", "db_wait_lt_100ms",
+    "db_wait_ge_100ms",
+    "db_busy_le_25pct", "db_busy_le_50pct", "db_busy_le_75pct",
+    "db_busy_le_100pct",
+    "static_tasks", "static_queue_full", "static_codel_drop", "static_steal",
+    "static_threads", "static_grow", "static_retire",
+    "db_tasks", "db_queue_full", "db_codel_drop", "db_steal",
+    "db_threads", "db_grow", "db_retire",
+};
+
+metrics::metrics() {
+    for (int i = 0; i < METRIC_NUMBER; ++i)
+        m_counters[i] = 0;
+}
+
+const char *metrics::name(METRIC m) { return metric_names[m]; }
+
+void metrics::report() {
+    char buf[2048];
+    int n = 0;
+    for (int i = 0; i < METRIC_NUMBER && n < (int)sizeof(buf); ++i) {
+        n += snprintf(buf + n, sizeof(buf) - n, "%s%s=%lld", i ? " " : "",
+                      metric_names[i], get((METRIC)i));
+    }
+    LOG_INFO("metrics: %s", buf);
+    Log::get_instance()->flush();
+}
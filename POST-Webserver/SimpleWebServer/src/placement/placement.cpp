@@ -0,0 +1,192 @@
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "placement.h"
+
+thread_local int placement::t_node = 0;
+
+placement::placement()
+    : m_cpu_number(1), m_node_number(1), m_next_reactor(0),
+      m_next_worker(0) {}
+
+// 解析"0-3,8,10-11"形式的列表，/sys中的CPU列表和节点列表都是这个格式
+static bool parse_list(const char *text, std::vector<int> &list) {
+    const char *p = text;
+    while (*p && *p != '\n') {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0)
+            return false;
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            ++p;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first)
+                return false;
+            p = end;
+        }
+        for (long i = first; i <= last; ++i)
+            list.push_back((int)i);
+        if (*p == ',')
+            ++p;
+        else if (*p && *p != '\n')
+            return false;
+    }
+    return true;
+}
+
+// 读取/sys下只有一行的列表文件
+static bool read_list(const char *path, std::vector<int> &list) {
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        return false;
+    char buf[4096];
+    bool ok = fgets(buf, sizeof(buf), fp) != NULL;
+    fclose(fp);
+    return ok && parse_list(buf, list) && !list.empty();
+}
+
+// 把列表写回"0-3,8"的格式
+static void format_list(const std::vector<int> &list, char *buf, int len) {
+    int n = 0;
+    buf[0] = '\0';
+    for (size_t i = 0; i < list.size() && n < len; ++i) {
+        size_t j = i;
+        while (j + 1 < list.size() && list[j + 1] == list[j] + 1)
+            ++j;
+        if (j == i)
+            n += snprintf(buf + n, len - n, "%s%d", n ? "," : "", list[i]);
+        else
+            n += snprintf(buf + n, len - n, "%s%d-%d", n ? "," : "", list[i],
+                          list[j]);
+        i = j;
+    }
+}
+
+void placement::init() {
+    m_cpu_number = sysconf(_SC_NPROCESSORS_CONF);
+    if (m_cpu_number <= 0)
+        m_cpu_number = 1;
+    m_cpu_node.assign(m_cpu_number, 0);
+    m_node_cpus.clear();
+
+    // 每个在线节点的CPU列表，节点编号可能不连续
+    std::vector<int> nodes;
+    if (read_list("/sys/devices/system/node/online", nodes)) {
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            char path[128];
+            snprintf(path, sizeof(path),
+                     "/sys/devices/system/node/node%d/cpulist", nodes[i]);
+            std::vector<int> cpus;
+            // 只有内存没有CPU的节点不参与分配
+            if (!read_list(path, cpus))
+                continue;
+            for (size_t j = 0; j < cpus.size(); ++j) {
+                if (cpus[j] < m_cpu_number)
+                    m_cpu_node[cpus[j]] = nodes[i];
+            }
+            if ((int)m_node_cpus.size() <= nodes[i])
+                m_node_cpus.resize(nodes[i] + 1);
+            m_node_cpus[nodes[i]] = cpus;
+        }
+    }
+    // 没有NUMA信息时所有CPU视为一个节点
+    if (m_node_cpus.empty()) {
+        std::vector<int> cpus;
+        if (!read_list("/sys/devices/system/cpu/online", cpus)) {
+            for (int i = 0; i < m_cpu_number; ++i)
+                cpus.push_back(i);
+        }
+        m_node_cpus.push_back(cpus);
+    }
+    m_node_number = 0;
+    for (size_t i = 0; i < m_node_cpus.size(); ++i)
+        if (!m_node_cpus[i].empty())
+            ++m_node_number;
+}
+
+bool placement::configure(const char *spec) {
+    const char *slash = strchr(spec, '/');
+    std::string reactor_part =
+        slash ? std::string(spec, slash - spec) : std::string(spec);
+    std::string worker_part = slash ? std::string(slash + 1) : std::string();
+    std::vector<int> reactor_cpus, worker_cpus;
+    if (!parse_list(reactor_part.c_str(), reactor_cpus) ||
+        !parse_list(worker_part.c_str(), worker_cpus))
+        return false;
+    for (size_t i = 0; i < reactor_cpus.size(); ++i)
+        if (reactor_cpus[i] >= m_cpu_number)
+            return false;
+    for (size_t i = 0; i < worker_cpus.size(); ++i)
+        if (worker_cpus[i] >= m_cpu_number)
+            return false;
+    m_reactor_cpus = reactor_cpus;
+    m_worker_cpus = worker_cpus;
+    return true;
+}
+
+void placement::log_topology() {
+    char buf[1024];
+    LOG_INFO("cpu topology: %d cpus, %d numa nodes", m_cpu_number,
+             m_node_number);
+    for (size_t i = 0; i < m_node_cpus.size(); ++i) {
+        if (m_node_cpus[i].empty())
+            continue;
+        format_list(m_node_cpus[i], buf, sizeof(buf));
+        LOG_INFO("numa node %d: cpus %s", (int)i, buf);
+    }
+    if (m_reactor_cpus.empty() && m_worker_cpus.empty()) {
+        LOG_INFO("%s", "cpu affinity: not configured");
+    } else {
+        char workers[1024];
+        format_list(m_reactor_cpus, buf, sizeof(buf));
+        format_list(m_worker_cpus, workers, sizeof(workers));
+        LOG_INFO("cpu affinity: reactors [%s], workers [%s]", buf, workers);
+    }
+    Log::get_instance()->flush();
+}
+
+int placement::node_of(int cpu) const {
+    return cpu < (int)m_cpu_node.size() ? m_cpu_node[cpu] : 0;
+}
+
+void placement::bind_reactor() {
+    bind(m_reactor_cpus, m_next_reactor, "reactor");
+}
+
+void placement::bind_worker() { bind(m_worker_cpus, m_next_worker, "worker"); }
+
+void placement::bind(const std::vector<int> &cpus, std::atomic<int> &next,
+                     const char *role) {
+    if (cpus.empty())
+        return;
+    int cpu = cpus[next.fetch_add(1) % cpus.size()];
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        LOG_ERROR("%s thread: bind to cpu %d failure", role, cpu);
+        Log::get_instance()->flush();
+        return;
+    }
+
+    // 优先在CPU所在的节点上分配内存，节点内存不足时内核会退回其他节点
+    int node = node_of(cpu);
+    unsigned long mask = 1UL << (node % (8 * sizeof(mask)));
+    bool local = m_node_number <= 1 ||
+                 syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask,
+                         8 * sizeof(mask) + 1) == 0;
+    t_node = node;
+    LOG_INFO("%s thread bound to cpu %d, numa node %d%s", role, cpu, node,
+             local ? "" : " (set_mempolicy failure)");
+    Log::get_instance()->flush();
+}
@@ -0,0 +1,312 @@
+#include <arpa/inet.h>
+#include <cassert>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "metrics.h"
+#include "placement.h"
+#include "reactor.h"
+
+// 这个函数在http_conn.cpp中定义，改变链接属性
+extern void addfd(int epollfd, int fd, bool one_shot, void *ptr);
+
+volatile bool reactor::m_stop_server = false;
+
+// 读头部10秒，读请求体30秒，keep-alive空闲15秒，发送无进展30秒
+int reactor::m_timeouts[http_conn::PHASE_NUMBER] = {10000, 30000, 15000,
+                                                     30000};
+
+// 与http_conn::TIMEOUT_PHASE的顺序一致
+static const METRIC timeout_metrics[http_conn::PHASE_NUMBER] = {
+    TIMEOUT_HEADER, TIMEOUT_BODY, TIMEOUT_IDLE, TIMEOUT_WRITE};
+
+// 删除连接在socket上的注册事件并关闭，连接对象随之放回所属反应堆的slab
+void reactor::release_conn(http_conn *conn) {
+    // 输出日志
+    LOG_INFO("close fd %d", conn->get_sockfd());
+    Log::get_instance()->flush();
+
+    conn->close_conn();
+    conn->owner->m_conns.free(conn);
+}
+
+// 定时器回调函数，连接在当前阶段超时，计数后关闭
+// 工作线程还持有连接时不能释放，重新计时：对端已关闭的稍后重试，
+// 否则连接已经进入下一阶段，按该阶段的超时重新计算
+void reactor::cb_func(http_conn *conn) {
+    assert(conn);
+    if (conn->in_flight.load(std::memory_order_acquire)) {
+        conn->timer.expire =
+            timer_now_ms() +
+            (conn->closing ? CLOSE_RETRY_MS : m_timeouts[conn->timer_phase]);
+        conn->owner->m_timer_lst.add_timer(&conn->timer);
+        return;
+    }
+    if (conn->closing) {
+        release_conn(conn);
+        return;
+    }
+    metrics::get_instance()->add(timeout_metrics[conn->timer_phase]);
+    LOG_INFO("fd %d timeout, %s", conn->get_sockfd(),
+             metrics::name(timeout_metrics[conn->timer_phase]));
+    release_conn(conn);
+}
+
+// 连接个数过多，返回错误信息，并断开连接
+static void show_error(int connfd, const char *info) {
+    LOG_ERROR("accept numbers are too big!, %s", info);
+    Log::get_instance()->flush();
+    send(connfd, info, strlen(info), 0);
+    close(connfd);
+}
+
+reactor::reactor(int listenfd, int max_conns, threadpool<http_conn> **pools)
+    : m_listenfd(listenfd), m_sigfd(-1), m_max_conns(max_conns),
+      m_conns(max_conns),
+      m_next_report(timer_now_ms() + METRICS_INTERVAL) {
+    for (int i = 0; i < http_conn::LANE_NUMBER; ++i)
+        m_pools[i] = pools ? pools[i] : NULL;
+    // 创建内核事件表
+    m_epollfd = epoll_create(5);
+    if (m_epollfd == -1)
+        throw std::exception();
+
+    /*
+    监听listenfd上是不能注册EPOLLONESHOT事件的；
+    但是对于socket的读、写事件，应注册为EPOLLONESHOT来保证一个socket连接
+    在任一时刻都只被一个线程处理
+    */
+    addfd(m_epollfd, m_listenfd, false, &m_listenfd);
+
+    m_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wakefd < 0) {
+        close(m_epollfd);
+        throw std::exception();
+    }
+    addfd(m_epollfd, m_wakefd, false, &m_wakefd);
+}
+
+reactor::~reactor() {
+    close(m_epollfd);
+    close(m_wakefd);
+}
+
+void reactor::set_signal_fd(int sigfd) {
+    // 设置signalfd为ET非阻塞，非一次性
+    m_sigfd = sigfd;
+    addfd(m_epollfd, m_sigfd, false, &m_sigfd);
+}
+
+void reactor::wakeup() {
+    uint64_t one = 1;
+    ssize_t ret = ::write(m_wakefd, &one, sizeof(one));
+    (void)ret;
+}
+
+void reactor::deal_wakeup() {
+    uint64_t count;
+    while (read(m_wakefd, &count, sizeof(count)) > 0)
+        continue;
+}
+
+void *reactor::worker(void *arg) {
+    reactor *r = (reactor *)arg;
+    r->loop();
+    return r;
+}
+
+bool reactor::start() {
+    return pthread_create(&m_thread, NULL, worker, this) == 0;
+}
+
+void reactor::join() { pthread_join(m_thread, NULL); }
+
+// 读写之后按连接所处的阶段调整定时器
+// 读头部和请求体的超时从阶段开始时计算，持续有数据到达也不会延长，
+// 慢速发送的客户端不能一直占用连接；发送阶段每次有进展都重新计时
+void reactor::adjust_timer(http_conn *conn) {
+    util_timer *timer = &conn->timer;
+    if (!timer->armed())
+        return;
+    http_conn::TIMEOUT_PHASE phase = conn->timeout_phase();
+    if (phase == conn->timer_phase && phase != http_conn::PHASE_WRITE)
+        return;
+    conn->timer_phase = phase;
+    timer->expire = timer_now_ms() + m_timeouts[phase];
+    m_timer_lst.adjust_timer(timer);
+}
+
+// 处理新到的客户连接
+void reactor::deal_accept() {
+    struct sockaddr_in client_address;
+    socklen_t client_addrlength = sizeof(client_address);
+    while (1) {
+        // 非阻塞，因为是ET模式，所以需要while循环
+        int connfd = accept(m_listenfd, (struct sockaddr *)&client_address,
+                            &client_addrlength);
+        if (connfd < 0) {
+            // 此时已经没有连接了，或者是连接出错了
+            if (errno != EAGAIN) {
+                LOG_ERROR("%s:errno is:%d", "accept error", errno);
+                Log::get_instance()->flush();
+            }
+            break;
+        }
+        http_conn *conn = NULL;
+        if (http_conn::m_user_count >= m_max_conns ||
+            !(conn = m_conns.alloc())) {
+            show_error(connfd, "Internal server is busy");
+            break;
+        }
+        conn->owner = this;
+        conn->init(connfd, client_address, m_epollfd);
+
+        // 定时器嵌在连接对象中，设置回调函数和超时时间后添加到堆中
+        util_timer *timer = &conn->timer;
+        timer->user_data = conn;
+        timer->cb_func = cb_func;
+        // 新连接从读头部阶段开始计时
+        timer->expire = timer_now_ms() + m_timeouts[http_conn::PHASE_HEADER];
+        conn->timer_phase = http_conn::PHASE_HEADER;
+        m_timer_lst.add_timer(timer);
+    }
+}
+
+// 处理signalfd上的信号，SIGTERM在main中被屏蔽，不会打断系统调用
+void reactor::deal_signal() {
+    struct signalfd_siginfo info;
+    while (read(m_sigfd, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo == SIGTERM) {
+            // 退出程序
+            m_stop_server = true;
+            LOG_INFO("%s", "program exit!");
+            Log::get_instance()->flush();
+        }
+    }
+}
+
+// 客户端关闭连接，移除对应的定时器
+// 工作线程还持有连接时交给定时器稍后释放
+void reactor::deal_close(http_conn *conn) {
+    if (!conn->timer.armed())
+        return;
+    if (conn->in_flight.load(std::memory_order_acquire)) {
+        conn->closing = true;
+        conn->timer.expire = timer_now_ms() + CLOSE_RETRY_MS;
+        m_timer_lst.adjust_timer(&conn->timer);
+        return;
+    }
+    m_timer_lst.del_timer(&conn->timer);
+    release_conn(conn);
+}
+
+// 处理客户连接上接收到的数据
+void reactor::deal_read(http_conn *conn) {
+    if (!conn->read_once()) {
+        // 关闭连接并移除定时器
+        deal_close(conn);
+        return;
+    }
+    LOG_INFO("deal with the client(%s)",
+             inet_ntoa(conn->get_address()->sin_addr));
+    Log::get_instance()->flush();
+
+    // 交给线程池之前确定阶段，之后连接可能正在被工作线程修改
+    adjust_timer(conn);
+    dispatch(conn);
+}
+
+// 解析读缓冲区中的请求并生成响应
+// 按请求的方法分到静态文件或数据库通道
+void reactor::dispatch(http_conn *conn) {
+    // 数据库熔断期间的注册与队列已满时一样直接回复503，不进入队列等待
+    if (!conn->db_admit()) {
+        conn->reject();
+        return;
+    }
+    threadpool<http_conn> *pool = m_pools[conn->route()];
+    if (pool) {
+        // 若监测到读事件，将该http事件放入对应通道的请求队列
+        // 队列已满时直接回复503，不让客户端一直等到超时
+        conn->in_flight.fetch_add(1, std::memory_order_relaxed);
+        if (!pool->append(conn)) {
+            conn->in_flight.fetch_sub(1, std::memory_order_relaxed);
+            conn->reject();
+        }
+    } else {
+        // one loop per thread，直接在本线程中解析并生成响应
+        conn->process();
+    }
+}
+
+// 处理客户连接上的发送数据
+void reactor::deal_write(http_conn *conn) {
+    if (!conn->write()) {
+        deal_close(conn);
+        return;
+    }
+    LOG_INFO("send data to the client(%s)",
+             inet_ntoa(conn->get_address()->sin_addr));
+    Log::get_instance()->flush();
+
+    adjust_timer(conn);
+    // 流水线中后续的请求已经在读缓冲区里，不必等待新的读事件
+    if (conn->has_buffered_request())
+        dispatch(conn);
+}
+
+void reactor::loop() {
+    // 按配置绑定CPU，之后在本线程中分配的连接对象和缓冲区都在本地节点
+    placement::get_instance()->bind_reactor();
+    while (!m_stop_server) {
+        // 一直等到最早的定时器到期，到期时间精确到毫秒，不需要额外的定时信号
+        int number = epoll_wait(m_epollfd, m_events, MAX_EVENT_NUMBER,
+                                m_timer_lst.next_timeout());
+        if (number < 0 && errno != EINTR) {
+            LOG_ERROR("%s", "epoll failure");
+            Log::get_instance()->flush();
+            break;
+        }
+
+        for (int i = 0; i < number; i++) {
+            void *ptr = m_events[i].data.ptr;
+            uint32_t events = m_events[i].events;
+
+            // 监听socket、signalfd和eventfd注册时用成员的地址作为标记
+            if (ptr == &m_listenfd) {
+                deal_accept();
+                continue;
+            }
+            if (ptr == &m_sigfd) {
+                if (events & EPOLLIN)
+                    deal_signal();
+                continue;
+            }
+            if (ptr == &m_wakefd) {
+                deal_wakeup();
+                continue;
+            }
+            http_conn *conn = (http_conn *)ptr;
+            if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                deal_close(conn);
+            else if (events & EPOLLIN)
+                deal_read(conn);
+            else if (events & EPOLLOUT)
+                deal_write(conn);
+        }
+
+        // 处理已经到期的定时器，没有到期的定时器时只比较一次堆顶
+        m_timer_lst.tick();
+
+        if (m_sigfd >= 0 && timer_now_ms() >= m_next_report) {
+            metrics::get_instance()->report();
+            m_next_report = timer_now_ms() + METRICS_INTERVAL;
+        }
+    }
+}